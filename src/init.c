@@ -10,11 +10,24 @@
 #include <unistd.h>
 
 #include "io-ctx.h"
+#include "utils-altrep-raw.h"
+#include "utils-altrep-lazy.h"
+#include "utils-altrep-mmap.h"
 
 extern SEXP zap_version_(void);
 extern SEXP write_zap_(SEXP obj_, SEXP filename_, SEXP opts_) ;
 extern SEXP read_zap_(SEXP filename_, SEXP opts_);
+extern SEXP read_zap_at_(SEXP src_, SEXP at_, SEXP opts_);
+extern SEXP zap_lazy_(SEXP info_, SEXP type_);
+extern SEXP write_zap_con_(SEXP obj_, SEXP con_, SEXP opts_);
+extern SEXP read_zap_con_(SEXP con_, SEXP opts_);
 extern SEXP zap_count_(SEXP x_, SEXP opts_);
+extern SEXP write_zap_shm_(SEXP obj_, SEXP name_, SEXP opts_);
+extern SEXP read_zap_shm_(SEXP name_, SEXP opts_);
+extern SEXP zap_shm_remove_(SEXP name_);
+extern SEXP read_zap_mmap_(SEXP filename_, SEXP opts_, SEXP borrow_);
+extern SEXP zap_push_create_(SEXP opts_);
+extern SEXP zap_push_feed_(SEXP ptr_, SEXP raw_);
   
 extern SEXP address_(SEXP x_);
     
@@ -24,6 +37,20 @@ static const R_CallMethodDef CEntries[] = {
   
   {"write_zap_"  , (DL_FUNC) &write_zap_  , 3},
   {"read_zap_"   , (DL_FUNC) &read_zap_   , 2},
+  {"read_zap_at_", (DL_FUNC) &read_zap_at_, 3},
+  {"zap_lazy_"   , (DL_FUNC) &zap_lazy_   , 2},
+  
+  {"write_zap_con_", (DL_FUNC) &write_zap_con_, 3},
+  {"read_zap_con_" , (DL_FUNC) &read_zap_con_ , 2},
+  
+  {"write_zap_shm_" , (DL_FUNC) &write_zap_shm_ , 3},
+  {"read_zap_shm_"  , (DL_FUNC) &read_zap_shm_  , 2},
+  {"zap_shm_remove_", (DL_FUNC) &zap_shm_remove_, 1},
+  
+  {"read_zap_mmap_", (DL_FUNC) &read_zap_mmap_, 3},
+  
+  {"zap_push_create_", (DL_FUNC) &zap_push_create_, 1},
+  {"zap_push_feed_"  , (DL_FUNC) &zap_push_feed_  , 2},
   
   {"zap_count_", (DL_FUNC) &zap_count_, 2},
   {"address_"  , (DL_FUNC) &address_  , 1},
@@ -42,6 +69,10 @@ void R_init_zap(DllInfo *info) {
     NULL       // External
   );
   R_useDynamicSymbols(info, FALSE);
+  
+  init_altrep_raw(info);
+  init_altrep_lazy(info);
+  init_altrep_mmap(info);
 }
 
 
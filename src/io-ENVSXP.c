@@ -14,6 +14,8 @@
 #include "io-ctx.h"
 #include "io-core.h"
 #include "io-ENVSXP.h"
+#include "io-frame.h"
+#include "io-index.h"
 
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -131,6 +133,7 @@ void write_ENVSXP(ctx_t *ctx, SEXP env_) {
     // Found the environment in the cache
     write_uint8(ctx, ENV_REFERENCE);
     write_len(ctx, (uint64_t)hash_idx);
+    index_ref(ctx, ZAP_CACHE_ENVSXP, hash_idx);
     return;
   }
 
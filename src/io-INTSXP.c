@@ -18,12 +18,19 @@
 #include "utils-shuffle.h"
 #include "utils-int-frame-delta.h"
 #include "utils-packing-1bit.h"
+#include "io-decode.h"
+#include "io-chunk.h"
+#include "io-frame.h"
+#include "io-index.h"
+#include "io-align.h"
+#include "utils-rans.h"
 
 
 #define BUF_ZIGZAG     0
 #define BUF_FRAME      0
 #define BUF_NA_PACKED  1
 #define BUF_SHUFFLE    2
+#define BUF_PLANES     3
 
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -37,35 +44,39 @@
 //
 //  Just writing out the integers "as-is" with no processing or transformation
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-void write_INTSXP_raw(ctx_t *ctx, SEXP x_) {
+static void write_INTSXP_raw_ptr(ctx_t *ctx, int32_t *x, size_t len) {
   write_uint8(ctx, INTSXP);      // SEXP
   write_uint8(ctx, ZAP_INT_RAW); // Integer encoding type
   
-  size_t len = (size_t)Rf_xlength(x_);
   write_len(ctx, len);
   if (len == 0) return;
   
-  ctx->write(ctx->user_data, (void *)DATAPTR_RO(x_), len * sizeof(int32_t));
+  ctx_write(ctx, (void *)x, len * sizeof(int32_t));
+}
+
+void write_INTSXP_raw(ctx_t *ctx, SEXP x_) {
+  write_INTSXP_raw_ptr(ctx, INTEGER(x_), (size_t)Rf_xlength(x_));
 }
 
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// Read uncompressed integer data
+// Write the integers "as-is" starting on a page boundary. See 'io-align.h'
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-SEXP read_INTSXP_raw(ctx_t *ctx) {
+static void write_INTSXP_aligned(ctx_t *ctx, int32_t *x, size_t len) {
+  write_uint8(ctx, INTSXP);
+  write_uint8(ctx, ZAP_INT_RAW | ZAP_ALIGNED);
   
-  size_t len = (size_t)read_len(ctx);
-  SEXP x_ = PROTECT(Rf_allocVector(INTSXP, (R_xlen_t)len)); 
-  
-  if (len == 0) {
-    UNPROTECT(1);
-    return x_;
-  }
+  write_len(ctx, len);
+  write_align_pad(ctx);
+  ctx_write(ctx, (void *)x, len * sizeof(int32_t));
+}
 
-  ctx->read(ctx->user_data, INTEGER(x_), len * sizeof(int32_t));
-    
-  UNPROTECT(1);
-  return x_;
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Read uncompressed integer data
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void read_INTSXP_raw(ctx_t *ctx, SEXP x_, int32_t *x, size_t len) {
+  ctx_read(ctx, x, len * sizeof(int32_t));
 }
 
 
@@ -83,39 +94,51 @@ SEXP read_INTSXP_raw(ctx_t *ctx) {
 //        a such a way that the "sign bit" isn't a determent to compression
 // Shufffle - shuffle bytes
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-void write_INTSXP_zzshuf(ctx_t *ctx, SEXP x_) {
+static void write_INTSXP_zzshuf(ctx_t *ctx, int32_t *x, size_t len) {
+  
+  bool entropy = ctx->opts->entropy;
   
   write_uint8(ctx, INTSXP);           // SEXP
-  write_uint8(ctx, ZAP_INT_ZZSHUF);  // Integer encoding type
+  write_uint8(ctx, ZAP_INT_ZZSHUF | (entropy ? ZAP_ENTROPY : 0));  // Integer encoding type
   
-  size_t len = (size_t)Rf_xlength(x_);
   write_len(ctx, (uint64_t)len);
   
   if (len == 0) return;
   
-  zigzag_encode_ptr_buf(ctx, INTEGER(x_), BUF_ZIGZAG, len);
+  zigzag_encode_ptr_buf(ctx, x, BUF_ZIGZAG, len);
   shuffle_delta4_buf_buf(ctx, BUF_ZIGZAG, BUF_SHUFFLE, len);
-  write_buf(ctx, BUF_SHUFFLE, len * sizeof(int));
+  if (entropy) {
+    write_planes(ctx, BUF_SHUFFLE, BUF_PLANES, sizeof(int), len);
+  } else {
+    write_buf(ctx, BUF_SHUFFLE, len * sizeof(int));
+  }
 }
 
 
-SEXP read_INTSXP_zzshuf(ctx_t *ctx) {
-  
-  size_t len = (size_t)read_len(ctx);
-  SEXP x_ = PROTECT(Rf_allocVector(INTSXP, (R_xlen_t)len)); 
-  
-  if (len == 0) {
-    UNPROTECT(1);
-    return x_;
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Decode kernel. See 'io-decode.h'
+//   src[0] shuffled bytes
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void decode_INTSXP_zzshuf(ctx_t *ctx, decode_job_t *job) {
+  uint8_t *src = job->src[0];
+  if (job->entropy) {
+    src = rans_decode_ptr_buf(ctx, src, job->nsrc[0], BUF_PLANES, sizeof(int), job->len);
   }
-  
-  read_buf(ctx, BUF_SHUFFLE);
-  unshuffle_delta4_buf_buf(ctx, BUF_SHUFFLE, BUF_ZIGZAG, len);
-  zigzag_decode_buf_ptr(ctx, BUF_ZIGZAG, INTEGER(x_), len);
-  
-  
-  UNPROTECT(1);
-  return x_;
+  unshuffle_delta4_ptr_buf(ctx, src, BUF_ZIGZAG, job->len);
+  zigzag_decode_buf_ptr(ctx, BUF_ZIGZAG, job->dst, job->len);
+}
+
+
+static void read_INTSXP_zzshuf(ctx_t *ctx, SEXP x_, int32_t *x, size_t len, bool entropy) {
+  
+  decode_job_t job = {
+    .fn      = decode_INTSXP_zzshuf,
+    .dst     = x,
+    .len     = len,
+    .entropy = entropy
+  };
+  job.src[0] = borrow_buf(ctx, BUF_SHUFFLE, &job.nsrc[0], 1);
+  decode_submit(ctx, x_, &job);
 }
 
 
@@ -130,22 +153,18 @@ SEXP read_INTSXP_zzshuf(ctx_t *ctx) {
 //   #  #  #        #     #  #  #   #         #      #   #  #  #  
 //  ####    ###    ###     ##    ####         #       ###   #   # 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-void write_INTSXP_deltaframe(ctx_t *ctx, SEXP x_) {
-  
-  
-  size_t len = (size_t)Rf_xlength(x_);
-  
+static void write_INTSXP_deltaframe(ctx_t *ctx, int32_t *x, size_t len) {
   
   int32_t ref = 0;  // reference level for encoding. 
   int32_t delta_offset = 0;
   size_t nbits = 0;
-  size_t nbytes = deltaframe_encode_ptr_buf(ctx, INTEGER(x_), BUF_FRAME, len, &ref, &delta_offset, &nbits);
+  size_t nbytes = deltaframe_encode_ptr_buf(ctx, x, BUF_FRAME, len, &ref, &delta_offset, &nbits);
   
   if (nbits == 32) {
     // There are too many bits required to encode the 'delta' between elements
     // which makes this integer encoding mode impractical.  So fall-back to 
     // just using ZZShuf
-    write_INTSXP_zzshuf(ctx, x_);
+    write_INTSXP_zzshuf(ctx, x, len);
     return;
   } 
   
@@ -164,44 +183,52 @@ void write_INTSXP_deltaframe(ctx_t *ctx, SEXP x_) {
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // Create the auxilliary bitstream of NA locations
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  size_t packed_len = pack_na_int(ctx, BUF_NA_PACKED, x_);
+  size_t packed_len = pack_na_int_ptr(ctx, BUF_NA_PACKED, x, len);
   write_buf(ctx, BUF_NA_PACKED, packed_len);
 }
 
 
-SEXP read_INTSXP_deltaframe(ctx_t *ctx) {
-  
-  size_t len = (size_t)read_len(ctx);
-  SEXP x_ = PROTECT(Rf_allocVector(INTSXP, (R_xlen_t)len)); 
-  
-  if (len == 0) {
-    UNPROTECT(1);
-    return x_;
-  }
-  
-  size_t nbits  = read_len(ctx);
-  
-  if (nbits == 32) {
-    Rf_error("read_INTSXP_deltaframe() nbits == 32"); 
-  }
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Decode kernel. See 'io-decode.h'
+//   src[0] packed frame
+//   src[1] NA bitstream
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void decode_INTSXP_deltaframe(ctx_t *ctx, decode_job_t *job) {
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // Unpack the delta-frame-of-reference encoded integers 
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  int32_t ref   = read_int32(ctx);
-  int32_t delta_offset = read_int32(ctx);
-  read_buf(ctx, BUF_FRAME);
-  deltaframe_decode_buf_ptr(ctx, BUF_FRAME, INTEGER(x_), len, ref, delta_offset, nbits);
-
+  void *frame = align_ptr(ctx, BUF_FRAME, job->src[0], job->nsrc[0], sizeof(uint64_t));
+  deltaframe_decode_ptr_ptr(ctx, frame, job->dst, job->len, job->ref, 
+                            job->delta_offset, job->nbits);
+  
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // Set NA values using the auxilliary NA bistream
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  read_buf(ctx, BUF_NA_PACKED);
-  unpack_na_int(ctx, BUF_NA_PACKED, x_, len);
+  void *na = align_ptr(ctx, BUF_NA_PACKED, job->src[1], job->nsrc[1], sizeof(uint32_t));
+  unpack_na_int_ptr_ptr(ctx, na, job->dst, job->len);
+}
 
+
+static void read_INTSXP_deltaframe(ctx_t *ctx, SEXP x_, int32_t *x, size_t len) {
   
-  UNPROTECT(1);
-  return x_;
+  size_t nbits  = read_len(ctx);
+  
+  if (nbits == 32) {
+    Rf_error("read_INTSXP_deltaframe() nbits == 32"); 
+  }
+  
+  decode_job_t job = {
+    .fn    = decode_INTSXP_deltaframe,
+    .dst   = x,
+    .len   = len,
+    .nbits = nbits
+  };
+  job.ref          = read_int32(ctx);
+  job.delta_offset = read_int32(ctx);
+  job.src[0] = borrow_buf(ctx, BUF_FRAME    , &job.nsrc[0], 1);
+  job.src[1] = borrow_buf(ctx, BUF_NA_PACKED, &job.nsrc[1], 1);
+  decode_submit(ctx, x_, &job);
 }
 
 
@@ -214,44 +241,89 @@ SEXP read_INTSXP_deltaframe(ctx_t *ctx) {
 //  #   #  #   #  #      #     
 //   ###    ###   #       ###  
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-void write_INTSXP(ctx_t *ctx, SEXP x_) {
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Write a slice of integers using the configured transform
+//
+// No R API calls. Safe to call from a worker thread.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void write_INTSXP_ptr(ctx_t *ctx, int32_t *x, size_t len) {
   
   // When vector length is below the threshold, just write 
   // the raw bytes without transformation
-  if (Rf_length(x_) < ctx->opts->int_threshold) {
-    write_INTSXP_raw(ctx, x_);
+  if ((int64_t)len < ctx->opts->int_threshold) {
+    write_INTSXP_raw_ptr(ctx, x, len);
     return;
   }
   
   
   switch(ctx->opts->int_transform) {
   case ZAP_INT_RAW:
-    write_INTSXP_raw(ctx, x_);
+    write_INTSXP_raw_ptr(ctx, x, len);
     break;
   case ZAP_INT_ZZSHUF:
-    write_INTSXP_zzshuf(ctx, x_);
+    write_INTSXP_zzshuf(ctx, x, len);
     break;
   case ZAP_INT_DELTAFRAME:
-    write_INTSXP_deltaframe(ctx, x_);
+    write_INTSXP_deltaframe(ctx, x, len);
     break;
   default:
-    Rf_error("write_INTSXP(): method unknown %i", ctx->opts->int_transform);
+    ctx_error(ctx, "write_INTSXP(): method unknown %i", ctx->opts->int_transform);
   }
   
 }
 
-SEXP read_INTSXP(ctx_t *ctx) {
-  int method = read_uint8(ctx);
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Write an integer vector. Long vectors are chunked. See 'io-chunk.h'
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void write_INTSXP(ctx_t *ctx, SEXP x_) {
+  
+  size_t len = (size_t)Rf_xlength(x_);
+  int32_t *x = INTEGER(x_);
+  
+  // Untransformed vectors are aligned in full, rather than chunked
+  bool raw = ctx->opts->int_transform == ZAP_INT_RAW || 
+    (int64_t)len < ctx->opts->int_threshold;
+  if (raw && align_payload(ctx, len * sizeof(int32_t))) {
+    write_INTSXP_aligned(ctx, x, len);
+    return;
+  }
   
-  switch(method) {
+  size_t chunk_len = ctx->opts->chunk_len;
+  if (len <= chunk_len) {
+    write_INTSXP_ptr(ctx, x, len);
+    return;
+  }
+  
+  int64_t owner = index_owner(ctx, x_);
+  write_chunk_header(ctx, INTSXP, len);
+  for (size_t start = 0; start < len; start += chunk_len) {
+    size_t n = len - start < chunk_len ? len - start : chunk_len;
+    int64_t k = index_begin_chunk(ctx, owner, n);
+    write_INTSXP_ptr(ctx, x + start, n);
+    index_end_chunk(ctx, k);
+  }
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Read 'len' integers into 'x' which is the data of 'x_' (or a slice of it)
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void read_INTSXP_ptr(ctx_t *ctx, int method, SEXP x_, int32_t *x, size_t len) {
+  
+  if (len == 0) return;
+  
+  bool entropy = (method & ZAP_ENTROPY) != 0;
+  
+  switch(method & ~ZAP_ENTROPY) {
   case ZAP_INT_RAW:
-    return read_INTSXP_raw(ctx);
+    read_INTSXP_raw(ctx, x_, x, len);
     break;
   case ZAP_INT_ZZSHUF:
-    return read_INTSXP_zzshuf(ctx);
+    read_INTSXP_zzshuf(ctx, x_, x, len, entropy);
     break;
   case ZAP_INT_DELTAFRAME:
-    return read_INTSXP_deltaframe(ctx);
+    read_INTSXP_deltaframe(ctx, x_, x, len);
     break;
   default:
     Rf_error("read_INTSXP(): method unknown %i", method);
@@ -259,3 +331,47 @@ SEXP read_INTSXP(ctx_t *ctx) {
 }
 
 
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Read a chunked vector. See 'io-chunk.h'
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static SEXP read_INTSXP_chunked(ctx_t *ctx) {
+  
+  size_t chunk_len;
+  size_t len = read_chunk_header(ctx, &chunk_len);
+  
+  SEXP x_ = PROTECT(Rf_allocVector(INTSXP, (R_xlen_t)len));
+  int32_t *x = INTEGER(x_);
+  
+  for (size_t start = 0; start < len; start += chunk_len) {
+    size_t n = len - start < chunk_len ? len - start : chunk_len;
+    
+    read_uint8(ctx); // SEXPTYPE
+    int method = read_uint8(ctx);
+    if ((size_t)read_len(ctx) != n) {
+      Rf_error("read_INTSXP(): Chunk length does not match");
+    }
+    read_INTSXP_ptr(ctx, method, x_, x + start, n);
+  }
+  
+  UNPROTECT(1);
+  return x_;
+}
+
+
+SEXP read_INTSXP(ctx_t *ctx) {
+  int method = read_uint8(ctx);
+  if (method == ZAP_CHUNKED) {
+    return read_INTSXP_chunked(ctx);
+  }
+  
+  size_t len = (size_t)read_len(ctx);
+  if (method & ZAP_ALIGNED) {
+    return read_aligned(ctx, INTSXP, len);
+  }
+  
+  SEXP x_ = PROTECT(Rf_allocVector(INTSXP, (R_xlen_t)len)); 
+  read_INTSXP_ptr(ctx, method, x_, INTEGER(x_), len);
+  
+  UNPROTECT(1);
+  return x_;
+}
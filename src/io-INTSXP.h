@@ -1,6 +1,7 @@
 
 void write_INTSXP_raw(ctx_t *ctx, SEXP x_);
-SEXP read_INTSXP_raw(ctx_t *ctx);
 
 void write_INTSXP(ctx_t *ctx, SEXP x_);
 SEXP read_INTSXP(ctx_t *ctx);
+
+void write_INTSXP_ptr(ctx_t *ctx, int32_t *x, size_t len);
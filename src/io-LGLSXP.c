@@ -16,32 +16,29 @@
 
 #include "io-LGLSXP.h"
 #include "utils-packing-1bit.h"
+#include "io-decode.h"
+#include "io-chunk.h"
+#include "io-frame.h"
+#include "io-index.h"
 
 #define BUF_PACKED     0
+#define BUF_NA         1
 
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // Read/write un-transformed LGL values
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-void write_LGLSXP_raw(ctx_t *ctx, SEXP x_) {
+static void write_LGLSXP_raw(ctx_t *ctx, int32_t *x, size_t len) {
   write_uint8(ctx, LGLSXP);
   write_uint8(ctx, ZAP_LGL_RAW);
-  size_t len = (size_t)Rf_length(x_);
   write_len(ctx, len);
   if (len == 0) return;
-  ctx->write(ctx->user_data, LOGICAL(x_), len * 4);
+  ctx_write(ctx, x, len * 4);
 }
 
 
-SEXP read_LGLSXP_raw(ctx_t *ctx) {
-  size_t len = read_len(ctx);
-  SEXP obj_ = PROTECT(Rf_allocVector(LGLSXP, (R_len_t)len));
-  
-  if (len > 0) {
-    ctx->read(ctx->user_data, LOGICAL(obj_), len * 4);
-  }  
-  UNPROTECT(1);
-  return obj_;
+static void read_LGLSXP_raw(ctx_t *ctx, SEXP x_, int32_t *x, size_t len) {
+  ctx_read(ctx, x, len * 4);
 }
 
 
@@ -68,12 +65,11 @@ SEXP read_LGLSXP_raw(ctx_t *ctx) {
 // unpacking the values it is easy to recognise when a run of 32 logicals
 // do not contain an NA value
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-void write_LGLSXP_packed(ctx_t *ctx, SEXP x_) {
+static void write_LGLSXP_packed(ctx_t *ctx, int32_t *x, size_t len) {
   
   // Header
   write_uint8(ctx, LGLSXP);
   write_uint8(ctx, ZAP_LGL_PACKED);
-  size_t len = (size_t)Rf_xlength(x_);
   write_len(ctx, len);
   
   // Early return
@@ -82,7 +78,7 @@ void write_LGLSXP_packed(ctx_t *ctx, SEXP x_) {
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // Pack T/F values into bitstream
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  size_t packed_len = pack_lgl(ctx, BUF_PACKED, x_);
+  size_t packed_len = pack_lgl_ptr(ctx, BUF_PACKED, x, len);
   write_buf(ctx, BUF_PACKED, packed_len);
   
   
@@ -90,7 +86,7 @@ void write_LGLSXP_packed(ctx_t *ctx, SEXP x_) {
   // Create the auxilliary bitstream of NA locations
   // Note: NAs for logical are identical to NAs for integer
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  pack_na_int(ctx, BUF_PACKED, x_);
+  pack_na_int_ptr(ctx, BUF_PACKED, x, len);
   
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -103,74 +99,112 @@ void write_LGLSXP_packed(ctx_t *ctx, SEXP x_) {
 
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// Read Logical values
+// Decode packed logical values.  See 'io-decode.h'
+//   src[0] T/F bitstream
+//   src[1] NA bitstream
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-SEXP read_LGLSXP_packed(ctx_t *ctx) {
+static void decode_LGLSXP_packed(ctx_t *ctx, decode_job_t *job) {
   
-  size_t len = read_len(ctx);
-  
-  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  // Allocate an R logical vector.
-  // This is initialised to all 0 by default
-  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  SEXP x_ = PROTECT(Rf_allocVector(LGLSXP, (R_xlen_t)len)); 
-  if (len == 0) {
-    UNPROTECT(1);
-    return x_;
-  }
+  int32_t *x = (int32_t *)job->dst;
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // Extract T/F values from bitstream
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  memset(LOGICAL(x_), 0, len * sizeof(int32_t));
-  read_buf(ctx, BUF_PACKED);
-  unpack_lgl(ctx, BUF_PACKED, x_, len);
+  memset(x, 0, job->len * sizeof(int32_t));
+  void *packed = align_ptr(ctx, BUF_PACKED, job->src[0], job->nsrc[0], sizeof(uint32_t));
+  unpack_lgl_ptr_ptr(ctx, packed, x, job->len);
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // Set NA values using the auxilliary NA bistream
   // Note: NAs for logical is encoded the same as NA for integer
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  read_buf(ctx, BUF_PACKED);
-  unpack_na_int(ctx, BUF_PACKED, x_, len);
-  
-  
-  UNPROTECT(1);
-  return x_;
+  void *na = align_ptr(ctx, BUF_NA, job->src[1], job->nsrc[1], sizeof(uint32_t));
+  unpack_na_int_ptr_ptr(ctx, na, x, job->len);
 }
 
 
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Read Logical values
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void read_LGLSXP_packed(ctx_t *ctx, SEXP x_, int32_t *x, size_t len) {
+  
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Locate the T/F bitstream and the NA bitstream, then decode
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  decode_job_t job = {
+    .fn  = decode_LGLSXP_packed,
+    .dst = x,
+    .len = len
+  };
+  job.src[0] = borrow_buf(ctx, BUF_PACKED, &job.nsrc[0], 1);
+  job.src[1] = borrow_buf(ctx, BUF_NA    , &job.nsrc[1], 1);
+  decode_submit(ctx, x_, &job);
+}
 
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// 
+// Write a slice of logicals using the configured transform
+//
+// No R API calls. Safe to call from a worker thread.
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-void write_LGLSXP(ctx_t *ctx, SEXP x_) {
+void write_LGLSXP_ptr(ctx_t *ctx, int32_t *x, size_t len) {
   
-  if (Rf_length(x_) < ctx->opts->lgl_threshold) {
-    write_LGLSXP_raw(ctx, x_);
+  if ((int64_t)len < ctx->opts->lgl_threshold) {
+    write_LGLSXP_raw(ctx, x, len);
     return;
   }
   
   switch(ctx->opts->lgl_transform) {
   case ZAP_LGL_RAW:
-    write_LGLSXP_raw(ctx, x_);
+    write_LGLSXP_raw(ctx, x, len);
     break;
   case ZAP_LGL_PACKED:
-    write_LGLSXP_packed(ctx, x_);
+    write_LGLSXP_packed(ctx, x, len);
     break;
   default:
-    Rf_error("write_LGLSXP(): lgl transform not understood: %i", ctx->opts->lgl_transform);
+    ctx_error(ctx, "write_LGLSXP(): lgl transform not understood: %i", ctx->opts->lgl_transform);
   }
 }
 
-SEXP read_LGLSXP(ctx_t *ctx) {
-  uint8_t method = read_uint8(ctx);
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Write a logical vector. Long vectors are chunked. See 'io-chunk.h'
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void write_LGLSXP(ctx_t *ctx, SEXP x_) {
+  
+  size_t len = (size_t)Rf_xlength(x_);
+  int32_t *x = LOGICAL(x_);
+  
+  size_t chunk_len = ctx->opts->chunk_len;
+  if (len <= chunk_len) {
+    write_LGLSXP_ptr(ctx, x, len);
+    return;
+  }
+  
+  int64_t owner = index_owner(ctx, x_);
+  write_chunk_header(ctx, LGLSXP, len);
+  for (size_t start = 0; start < len; start += chunk_len) {
+    size_t n = len - start < chunk_len ? len - start : chunk_len;
+    int64_t k = index_begin_chunk(ctx, owner, n);
+    write_LGLSXP_ptr(ctx, x + start, n);
+    index_end_chunk(ctx, k);
+  }
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Read 'len' logicals into 'x' which is the data of 'x_' (or a slice of it)
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void read_LGLSXP_ptr(ctx_t *ctx, uint8_t method, SEXP x_, int32_t *x, size_t len) {
+  
+  if (len == 0) return;
+  
   switch(method) {
   case ZAP_LGL_RAW:
-    return read_LGLSXP_raw(ctx);
+    read_LGLSXP_raw(ctx, x_, x, len);
     break;
   case ZAP_LGL_PACKED:
-    return read_LGLSXP_packed(ctx);
+    read_LGLSXP_packed(ctx, x_, x, len);
     break;
   default:
     Rf_error("read_LGLSXP(): lgl transform not understood: %i", method);
@@ -178,14 +212,43 @@ SEXP read_LGLSXP(ctx_t *ctx) {
 }
 
 
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Read a chunked vector. See 'io-chunk.h'
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static SEXP read_LGLSXP_chunked(ctx_t *ctx) {
+  
+  size_t chunk_len;
+  size_t len = read_chunk_header(ctx, &chunk_len);
+  
+  SEXP x_ = PROTECT(Rf_allocVector(LGLSXP, (R_xlen_t)len));
+  int32_t *x = LOGICAL(x_);
+  
+  for (size_t start = 0; start < len; start += chunk_len) {
+    size_t n = len - start < chunk_len ? len - start : chunk_len;
+    
+    read_uint8(ctx); // SEXPTYPE
+    uint8_t method = read_uint8(ctx);
+    if ((size_t)read_len(ctx) != n) {
+      Rf_error("read_LGLSXP(): Chunk length does not match");
+    }
+    read_LGLSXP_ptr(ctx, method, x_, x + start, n);
+  }
+  
+  UNPROTECT(1);
+  return x_;
+}
 
 
-
-
-
-
-
-
-
-
-
+SEXP read_LGLSXP(ctx_t *ctx) {
+  uint8_t method = read_uint8(ctx);
+  if (method == ZAP_CHUNKED) {
+    return read_LGLSXP_chunked(ctx);
+  }
+  
+  size_t len = read_len(ctx);
+  SEXP x_ = PROTECT(Rf_allocVector(LGLSXP, (R_xlen_t)len));
+  read_LGLSXP_ptr(ctx, method, x_, LOGICAL(x_), len);
+  
+  UNPROTECT(1);
+  return x_;
+}
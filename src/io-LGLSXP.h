@@ -1,3 +1,5 @@
 
 void write_LGLSXP(ctx_t *ctx, SEXP x_);
 SEXP read_LGLSXP(ctx_t *ctx);
+
+void write_LGLSXP_ptr(ctx_t *ctx, int32_t *x, size_t len);
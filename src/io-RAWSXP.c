@@ -13,6 +13,7 @@
 
 #include "io-ctx.h"
 #include "io-RAWSXP.h"
+#include "io-align.h"
 
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -22,25 +23,38 @@
 //   - sexptype
 //   - length
 //   - bytes
+//
+// Large vectors may be aligned. See 'io-align.h'
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 void write_RAWSXP(ctx_t *ctx, SEXP x_) {
-  write_uint8(ctx, RAWSXP);
   size_t len = (size_t)Rf_xlength(x_);
+  bool aligned = align_payload(ctx, len);
+  
+  write_uint8(ctx, aligned ? RAWSXP | ZAP_ALIGNED : RAWSXP);
   write_len(ctx, len);
-  ctx->write(ctx->user_data, RAW(x_), len);
+  if (aligned) {
+    write_align_pad(ctx);
+  }
+  ctx_write(ctx, RAW(x_), len);
 }
 
 
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // Read raw vector
+//
+// @param type the SEXPTYPE byte, which also flags an aligned vector
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-SEXP read_RAWSXP(ctx_t *ctx) {
+SEXP read_RAWSXP(ctx_t *ctx, uint8_t type) {
   size_t len = read_len(ctx);
+  if (type & ZAP_ALIGNED) {
+    return read_aligned(ctx, RAWSXP, len);
+  }
+  
   SEXP x_ = PROTECT(Rf_allocVector(RAWSXP, (R_xlen_t)len)); 
   
   if (len > 0) {
-    ctx->read(ctx->user_data, RAW(x_), len);
+    ctx_read(ctx, RAW(x_), len);
   }
   
   UNPROTECT(1);
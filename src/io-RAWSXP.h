@@ -1,3 +1,3 @@
 
 void write_RAWSXP(ctx_t *ctx, SEXP x_);
-SEXP read_RAWSXP(ctx_t *ctx);
+SEXP read_RAWSXP(ctx_t *ctx, uint8_t type);
@@ -17,6 +17,12 @@
 #include "utils-shuffle.h"
 #include "utils-ints.h"
 #include "utils-alp.h"
+#include "io-decode.h"
+#include "io-chunk.h"
+#include "io-frame.h"
+#include "io-index.h"
+#include "io-align.h"
+#include "utils-rans.h"
 
 
 
@@ -43,24 +49,18 @@
 // 
 // Read/write raw untransformed values
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-void write_REALSXP_raw(ctx_t *ctx, SEXP x_, bool is_complex) {
+static void write_REALSXP_raw(ctx_t *ctx, double *x, size_t len, bool is_complex) {
   
   // Header: SEXPTYPE + Encoding type
   write_uint8(ctx, is_complex ? CPLXSXP : REALSXP);
   write_uint8(ctx, ZAP_DBL_RAW);
   
-  // 'len' = Num Doubles
-  size_t len = (size_t)Rf_xlength(x_);
-  if (is_complex) {
-    len *= 2;
-  }
-  
-  // Write length
+  // Write length. 'len' = Num Doubles
   write_len(ctx, (uint64_t)len);
   if (len == 0) return;
   
   // Write data
-  write_ptr(ctx, (void *)DATAPTR_RO(x_), len * sizeof(double));
+  write_ptr(ctx, (void *)x, len * sizeof(double));
 }
 
 
@@ -68,33 +68,22 @@ void write_REALSXP_raw(ctx_t *ctx, SEXP x_, bool is_complex) {
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // Read uncompressed stream of doubles
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-SEXP read_REALSXP_raw(ctx_t *ctx, bool is_complex) {
-  
-  // Read length and create vector of correct type
-  size_t len = (size_t)read_len(ctx);
-  SEXP x_;
-  if (is_complex) {
-    x_ = PROTECT(Rf_allocVector(CPLXSXP, (R_xlen_t)len / 2)); 
-  } else {
-    x_ = PROTECT(Rf_allocVector(REALSXP, (R_xlen_t)len)); 
-  }
-  
-  // Early exit
-  if (len == 0) {
-    UNPROTECT(1);
-    return x_;
-  }
-  
+static void read_REALSXP_raw(ctx_t *ctx, SEXP x_, double *x, size_t len) {
   // Read data directly into R object
-  if (is_complex) {
-    read_ptr(ctx, COMPLEX(x_));
-  } else {
-    read_ptr(ctx, REAL(x_));
-  }
+  read_ptr(ctx, x);
+}
 
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Write the doubles "as-is" starting on a page boundary. See 'io-align.h'
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void write_REALSXP_aligned(ctx_t *ctx, double *x, size_t len, bool is_complex) {
+  write_uint8(ctx, is_complex ? CPLXSXP : REALSXP);
+  write_uint8(ctx, ZAP_DBL_RAW | ZAP_ALIGNED);
   
-  UNPROTECT(1);
-  return x_;
+  write_len(ctx, (uint64_t)len);
+  write_align_pad(ctx);
+  ctx_write(ctx, (void *)x, len * sizeof(double));
 }
 
 
@@ -108,70 +97,66 @@ SEXP read_REALSXP_raw(ctx_t *ctx, bool is_complex) {
 //   ###   #   #   ## #   #      #      ###    ###  
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 #define BUF_SHUFFLE    0
+#define BUF_PLANES     1
 
-void write_REALSXP_shuffle(ctx_t *ctx, SEXP x_, bool is_complex) {
+static void write_REALSXP_shuffle(ctx_t *ctx, double *x, size_t len, bool is_complex) {
+  
+  bool entropy = ctx->opts->entropy;
   
   // Write: sexptype + encoding type + length
   write_uint8(ctx, is_complex ? CPLXSXP : REALSXP);
-  write_uint8(ctx, ZAP_DBL_SHUF);
-  
-  // 'len' is number of doubles
-  size_t len = (size_t)Rf_xlength(x_);
-  if (is_complex) {
-    len *= 2;
-  }
+  write_uint8(ctx, ZAP_DBL_SHUF | (entropy ? ZAP_ENTROPY : 0));
   
-  // write the length
+  // write the length. 'len' is number of doubles
   write_len(ctx, (uint64_t)len);
   
   // early return
   if (len == 0) return;
   
   // Delta+Shuffle the 8-bytes in each double
-  shuffle8_ptr_buf(ctx, (void *)DATAPTR_RO(x_), BUF_SHUFFLE, len);
+  shuffle8_ptr_buf(ctx, (void *)x, BUF_SHUFFLE, len);
   
   // Write the compressed data
-  write_buf(ctx, BUF_SHUFFLE, len * sizeof(double));
+  if (entropy) {
+    write_planes(ctx, BUF_SHUFFLE, BUF_PLANES, sizeof(double), len);
+  } else {
+    write_buf(ctx, BUF_SHUFFLE, len * sizeof(double));
+  }
 }
 
 
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// Read Delta+Shuffled data
+// Decode kernel. See 'io-decode.h'
+//   src[0] shuffled bytes
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-SEXP read_REALSXP_shuffle(ctx_t *ctx, bool is_complex) {
-  
-  // Read the length and create an empty vector of the correct type
-  size_t len = (size_t)read_len(ctx);
-  SEXP x_;
-  if (is_complex) {
-    x_ = PROTECT(Rf_allocVector(CPLXSXP, (R_xlen_t)len / 2)); 
-  } else {
-    x_ = PROTECT(Rf_allocVector(REALSXP, (R_xlen_t)len)); 
-  }
-  
-  // Early exit
-  if (len == 0) {
-    UNPROTECT(1);
-    return x_;
-  }
-  
-  // Read compressed data and decompress
-  read_buf(ctx, BUF_SHUFFLE);
-  
-  // Unshuffle
-  if (is_complex) {
-    unshuffle8_buf_ptr(ctx, BUF_SHUFFLE, COMPLEX(x_), len);
-  } else {
-    unshuffle8_buf_ptr(ctx, BUF_SHUFFLE, REAL(x_), len);
+static void decode_REALSXP_shuffle(ctx_t *ctx, decode_job_t *job) {
+  uint8_t *src = job->src[0];
+  if (job->entropy) {
+    src = rans_decode_ptr_buf(ctx, src, job->nsrc[0], BUF_PLANES, sizeof(double), job->len);
   }
-  
-  
-  UNPROTECT(1);
-  return x_;
+  unshuffle8_ptr_ptr(ctx, src, job->dst, job->len);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Read Delta+Shuffled data
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void read_REALSXP_shuffle(ctx_t *ctx, SEXP x_, double *x, size_t len, bool entropy) {
+  
+  // Borrow the compressed data (or read it into a buffer) and decompress
+  decode_job_t job = {
+    .fn      = decode_REALSXP_shuffle,
+    .dst     = x,
+    .len     = len,
+    .entropy = entropy
+  };
+  job.src[0] = borrow_buf(ctx, BUF_SHUFFLE, &job.nsrc[0], 1);
+  decode_submit(ctx, x_, &job);
 }
 
 #undef BUF_SHUFFLE
+#undef BUF_PLANES
 
 
 
@@ -185,70 +170,66 @@ SEXP read_REALSXP_shuffle(ctx_t *ctx, bool is_complex) {
 //  ####    ###    ###     ##    ####   ###   #   #   ## #   #    
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 #define BUF_SHUFFLE    0
+#define BUF_PLANES     1
 
-void write_REALSXP_delta_shuffle(ctx_t *ctx, SEXP x_, bool is_complex) {
+static void write_REALSXP_delta_shuffle(ctx_t *ctx, double *x, size_t len, bool is_complex) {
 
+  bool entropy = ctx->opts->entropy;
+  
   // Write: sexptype + encoding type + length
   write_uint8(ctx, is_complex ? CPLXSXP : REALSXP);
-  write_uint8(ctx, ZAP_DBL_SHUF_DELTA);
+  write_uint8(ctx, ZAP_DBL_SHUF_DELTA | (entropy ? ZAP_ENTROPY : 0));
   
-  // 'len' is number of doubles
-  size_t len = (size_t)Rf_xlength(x_);
-  if (is_complex) {
-    len *= 2;
-  }
-  
-  // write the length
+  // write the length. 'len' is number of doubles
   write_len(ctx, (uint64_t)len);
   
   // early return
   if (len == 0) return;
   
   // Delta+Shuffle the 8-bytes in each double
-  shuffle_delta8_ptr_buf(ctx, (void *)DATAPTR_RO(x_), BUF_SHUFFLE, len);
+  shuffle_delta8_ptr_buf(ctx, (void *)x, BUF_SHUFFLE, len);
   
   // Write the compressed data
-  write_buf(ctx, BUF_SHUFFLE, len * sizeof(double));
+  if (entropy) {
+    write_planes(ctx, BUF_SHUFFLE, BUF_PLANES, sizeof(double), len);
+  } else {
+    write_buf(ctx, BUF_SHUFFLE, len * sizeof(double));
+  }
 }
 
 
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// Read Delta+Shuffled data
+// Decode kernel. See 'io-decode.h'
+//   src[0] delta+shuffled bytes
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-SEXP read_REALSXP_delta_shuffle(ctx_t *ctx, bool is_complex) {
-  
-  // Read the length and create an empty vector of the correct type
-  size_t len = (size_t)read_len(ctx);
-  SEXP x_;
-  if (is_complex) {
-    x_ = PROTECT(Rf_allocVector(CPLXSXP, (R_xlen_t)len / 2)); 
-  } else {
-    x_ = PROTECT(Rf_allocVector(REALSXP, (R_xlen_t)len)); 
-  }
-  
-  // Early exit
-  if (len == 0) {
-    UNPROTECT(1);
-    return x_;
-  }
-  
-  // Read compressed data and decompress
-  read_buf(ctx, BUF_SHUFFLE);
-  
-  // Unshuffle
-  if (is_complex) {
-    unshuffle_delta8_buf_ptr(ctx, BUF_SHUFFLE, COMPLEX(x_), len);
-  } else {
-    unshuffle_delta8_buf_ptr(ctx, BUF_SHUFFLE, REAL(x_), len);
+static void decode_REALSXP_delta_shuffle(ctx_t *ctx, decode_job_t *job) {
+  uint8_t *src = job->src[0];
+  if (job->entropy) {
+    src = rans_decode_ptr_buf(ctx, src, job->nsrc[0], BUF_PLANES, sizeof(double), job->len);
   }
-  
-  
-  UNPROTECT(1);
-  return x_;
+  unshuffle_delta8_ptr_ptr(ctx, src, job->dst, job->len);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Read Delta+Shuffled data
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void read_REALSXP_delta_shuffle(ctx_t *ctx, SEXP x_, double *x, size_t len, bool entropy) {
+  
+  // Borrow the compressed data (or read it into a buffer) and decompress
+  decode_job_t job = {
+    .fn      = decode_REALSXP_delta_shuffle,
+    .dst     = x,
+    .len     = len,
+    .entropy = entropy
+  };
+  job.src[0] = borrow_buf(ctx, BUF_SHUFFLE, &job.nsrc[0], 1);
+  decode_submit(ctx, x_, &job);
 }
 
 #undef BUF_SHUFFLE
+#undef BUF_PLANES
 
 
 
@@ -271,17 +252,7 @@ SEXP read_REALSXP_delta_shuffle(ctx_t *ctx, bool is_complex) {
 //   #   #  #      #     
 //   #   #  #####  #     
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-void write_REALSXP_alp0(ctx_t *ctx, SEXP x_, bool is_complex) {
-  
-  size_t len = (size_t)Rf_xlength(x_);
-  if (is_complex) {
-    len *= 2;
-  }
-  
-  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  // Get an appropriate pointer to the data.
-  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  double *x = is_complex ? (double *)COMPLEX(x_) : REAL(x_);
+static void write_REALSXP_alp0(ctx_t *ctx, double *x, size_t len, bool is_complex) {
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // ALP probe
@@ -301,16 +272,16 @@ void write_REALSXP_alp0(ctx_t *ctx, SEXP x_, bool is_complex) {
   if (((double)pparams.score / (double)pparams.ntest ) < 0.9) {
     switch (ctx->opts->dbl_fallback) {
     case ZAP_DBL_RAW:
-      write_REALSXP_raw(ctx, x_, is_complex);
+      write_REALSXP_raw(ctx, x, len, is_complex);
       break;
     case ZAP_DBL_SHUF:
-      write_REALSXP_shuffle(ctx, x_, is_complex);
+      write_REALSXP_shuffle(ctx, x, len, is_complex);
       break;
     case ZAP_DBL_SHUF_DELTA:
-      write_REALSXP_delta_shuffle(ctx, x_, is_complex);
+      write_REALSXP_delta_shuffle(ctx, x, len, is_complex);
       break;
     default:
-      Rf_error("REALSXP: unknown fallback");
+      ctx_error(ctx, "REALSXP: unknown fallback");
     }
     return;
   }
@@ -322,8 +293,9 @@ void write_REALSXP_alp0(ctx_t *ctx, SEXP x_, bool is_complex) {
   //  - encoding type
   //  - length
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  bool entropy = ctx->opts->entropy;
   write_uint8(ctx, is_complex ? CPLXSXP : REALSXP);
-  write_uint8(ctx, ZAP_DBL_ALP);
+  write_uint8(ctx, ZAP_DBL_ALP | (entropy ? ZAP_ENTROPY : 0));
   write_len(ctx, (uint64_t)len);
   
   if (len == 0) return;
@@ -390,124 +362,176 @@ void write_REALSXP_alp0(ctx_t *ctx, SEXP x_, bool is_complex) {
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // Write the compressed data
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  write_buf(ctx, BUF_SHUF, len * sizeof(double));
+  if (entropy) {
+    write_planes(ctx, BUF_SHUF, BUF_COMP, sizeof(double), len);
+  } else {
+    write_buf(ctx, BUF_SHUF, len * sizeof(double));
+  }
 }
 
 
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// Read ALP compressed doubles
+// Decode kernel. See 'io-decode.h'
+//   src[0] shuffled patch indices ('npatch' uint32_t). See 'write_uint32_buf()'
+//   src[1] patch values
+//   src[2] delta+shuffled ALP data. Entropy coded planes if 'job->entropy',
+//          decoded into BUF_COMP once src[0] is done with
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-SEXP read_REALSXP_alp0(ctx_t *ctx, bool is_complex) {
-  
-  size_t len = (size_t)read_len(ctx);
+static void decode_REALSXP_alp0(ctx_t *ctx, decode_job_t *job) {
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  // Initialise an object of the correct type
+  // Patches
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  SEXP x_;
-  if (is_complex) {
-    x_ = PROTECT(Rf_allocVector(CPLXSXP, (R_xlen_t)len / 2)); 
-  } else {
-    x_ = PROTECT(Rf_allocVector(REALSXP, (R_xlen_t)len)); 
-  }
-  
-  // Early return
-  if (len == 0) {
-    UNPROTECT(1);
-    return x_;
+  if (job->npatch > 0) {
+    unshuffle_delta4_ptr_buf(ctx, job->src[0], BUF_PATCH_IDX, job->npatch);
   }
-  
-  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  // Read patches
-  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  size_t npatch = read_uint32_buf(ctx, BUF_PATCH_IDX);
-  read_buf(ctx, BUF_PATCH);
-  
-  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  // Read key parameters for ALP: 'e' and 'f'
-  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  uint8_t e = read_uint8(ctx);
-  uint8_t f = read_uint8(ctx);
+  void *patch = align_ptr(ctx, BUF_PATCH, job->src[1], job->nsrc[1], sizeof(double));
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // Uncompress the ALP data
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  read_buf(ctx, BUF_SHUF);
-  unshuffle_delta8_buf_buf(ctx, BUF_SHUF, BUF_ALP, len);
+  uint8_t *shuf = job->src[2];
+  if (job->entropy) {
+    shuf = rans_decode_ptr_buf(ctx, shuf, job->nsrc[2], BUF_COMP, sizeof(double), job->len);
+  }
+  unshuffle_delta8_ptr_buf(ctx, shuf, BUF_ALP, job->len);
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // ALP decode
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  double *x = is_complex ? (double *)COMPLEX(x_) : REAL(x_);
-  
   alp_decode(
     (int64_t *)ctx->buf[BUF_ALP],     // ALP encoded data
-    x,                                // destination for doubles
-    len,                              // number of doubles
-    e,                                // ALP parameter
-    f,                                // ALP parameter
-    (void *)ctx->buf[BUF_PATCH],      // Patch values
+    (double *)job->dst,               // destination for doubles
+    job->len,                         // number of doubles
+    job->e,                           // ALP parameter
+    job->f,                           // ALP parameter
+    (void *)patch,                    // Patch values
     (void *)ctx->buf[BUF_PATCH_IDX],  // Patch indices
-    (uint32_t)npatch                  // number of patches
+    (uint32_t)job->npatch             // number of patches
   );
-  
-  UNPROTECT(1);
-  return x_;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Read ALP compressed doubles
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void read_REALSXP_alp0(ctx_t *ctx, SEXP x_, double *x, size_t len, bool entropy) {
+  
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Locate patches, the ALP parameters 'e' and 'f', and the shuffled ALP data
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  decode_job_t job = {
+    .fn      = decode_REALSXP_alp0,
+    .dst     = x,
+    .len     = len,
+    .entropy = entropy
+  };
+  job.src[0] = borrow_uint32_buf(ctx, BUF_COMP, &job.npatch);
+  job.src[1] = borrow_buf(ctx, BUF_PATCH, &job.nsrc[1], 1);
+  job.e      = read_uint8(ctx);
+  job.f      = read_uint8(ctx);
+  job.src[2] = borrow_buf(ctx, BUF_SHUF, &job.nsrc[2], 1);
+  decode_submit(ctx, x_, &job);
 }
 
 
 
 
-void write_REALSXP(ctx_t *ctx, SEXP x_, bool is_complex) {
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Write a slice of doubles using the configured transform
+//
+// No R API calls. Safe to call from a worker thread.
+//
+// @param x doubles. For complex vectors, the interleaved real/imaginary parts
+// @param len number of doubles
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void write_REALSXP_ptr(ctx_t *ctx, double *x, size_t len, bool is_complex) {
   
-  if (Rf_length(x_) < ctx->opts->dbl_threshold) {
-    write_REALSXP_raw(ctx, x_, is_complex);
+  if ((int64_t)(is_complex ? len / 2 : len) < ctx->opts->dbl_threshold) {
+    write_REALSXP_raw(ctx, x, len, is_complex);
     return;
   }
   
   
   switch(ctx->opts->dbl_transform) {
   case ZAP_DBL_RAW:
-    write_REALSXP_raw(ctx, x_, is_complex);
+    write_REALSXP_raw(ctx, x, len, is_complex);
     break;
   case ZAP_DBL_SHUF:
-    write_REALSXP_shuffle(ctx, x_, is_complex);
+    write_REALSXP_shuffle(ctx, x, len, is_complex);
     break;
   case ZAP_DBL_SHUF_DELTA:
-    write_REALSXP_delta_shuffle(ctx, x_, is_complex);
+    write_REALSXP_delta_shuffle(ctx, x, len, is_complex);
     break;
   case ZAP_DBL_ALP:
-    write_REALSXP_alp0(ctx, x_, is_complex);
+    write_REALSXP_alp0(ctx, x, len, is_complex);
     break;
   default:
-    Rf_error("write_REALSXP(): dbl transform not known: %i", ctx->opts->dbl_transform);
+    ctx_error(ctx, "write_REALSXP(): dbl transform not known: %i", ctx->opts->dbl_transform);
   }
   
 }
 
 
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Write a double or complex vector. Long vectors are chunked. See 'io-chunk.h'
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void write_REALSXP(ctx_t *ctx, SEXP x_, bool is_complex) {
+  
+  size_t len   = (size_t)Rf_xlength(x_);
+  size_t width = is_complex ? 2 : 1;
+  double *x    = is_complex ? (double *)COMPLEX(x_) : REAL(x_);
+  
+  // Untransformed vectors are aligned in full, rather than chunked
+  bool raw = ctx->opts->dbl_transform == ZAP_DBL_RAW || 
+    (int64_t)len < ctx->opts->dbl_threshold;
+  if (raw && align_payload(ctx, len * width * sizeof(double))) {
+    write_REALSXP_aligned(ctx, x, len * width, is_complex);
+    return;
+  }
+  
+  size_t chunk_len = ctx->opts->chunk_len;
+  if (len <= chunk_len) {
+    write_REALSXP_ptr(ctx, x, len * width, is_complex);
+    return;
+  }
+  
+  int64_t owner = index_owner(ctx, x_);
+  write_chunk_header(ctx, is_complex ? CPLXSXP : REALSXP, len);
+  for (size_t start = 0; start < len; start += chunk_len) {
+    size_t n = len - start < chunk_len ? len - start : chunk_len;
+    int64_t k = index_begin_chunk(ctx, owner, n);
+    write_REALSXP_ptr(ctx, x + start * width, n * width, is_complex);
+    index_end_chunk(ctx, k);
+  }
+}
+
+
 
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Read 'len' doubles into 'x' which is the data of 'x_' (or a slice of it)
 // The READ function dispatches on the 'encoding method' byte
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-SEXP read_REALSXP(ctx_t *ctx, bool is_complex) {
+static void read_REALSXP_ptr(ctx_t *ctx, uint8_t method, SEXP x_, double *x, size_t len) {
   
-  uint8_t method = read_uint8(ctx);
+  if (len == 0) return;
   
-  switch(method) {
+  bool entropy = (method & ZAP_ENTROPY) != 0;
+  
+  switch(method & ~ZAP_ENTROPY) {
   case ZAP_DBL_RAW:
-    return read_REALSXP_raw(ctx, is_complex);
+    read_REALSXP_raw(ctx, x_, x, len);
     break;
   case ZAP_DBL_SHUF:
-    return read_REALSXP_shuffle(ctx, is_complex);
+    read_REALSXP_shuffle(ctx, x_, x, len, entropy);
     break;
   case ZAP_DBL_SHUF_DELTA:
-    return read_REALSXP_delta_shuffle(ctx, is_complex);
+    read_REALSXP_delta_shuffle(ctx, x_, x, len, entropy);
     break;
   case ZAP_DBL_ALP:
-    return read_REALSXP_alp0(ctx, is_complex);
+    read_REALSXP_alp0(ctx, x_, x, len, entropy);
     break;
   default:
     Rf_error("read_REALSXP(): method not understood: %i", method);
@@ -515,6 +539,61 @@ SEXP read_REALSXP(ctx_t *ctx, bool is_complex) {
 }
 
 
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Read a chunked vector. See 'io-chunk.h'
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static SEXP read_REALSXP_chunked(ctx_t *ctx, bool is_complex) {
+  
+  size_t chunk_len;
+  size_t len   = read_chunk_header(ctx, &chunk_len);
+  size_t width = is_complex ? 2 : 1;
+  
+  SEXP x_ = PROTECT(Rf_allocVector(is_complex ? CPLXSXP : REALSXP, (R_xlen_t)len));
+  double *x = is_complex ? (double *)COMPLEX(x_) : REAL(x_);
+  
+  for (size_t start = 0; start < len; start += chunk_len) {
+    size_t n = len - start < chunk_len ? len - start : chunk_len;
+    
+    read_uint8(ctx); // SEXPTYPE
+    uint8_t method = read_uint8(ctx);
+    if ((size_t)read_len(ctx) != n * width) {
+      Rf_error("read_REALSXP(): Chunk length does not match");
+    }
+    read_REALSXP_ptr(ctx, method, x_, x + start * width, n * width);
+  }
+  
+  UNPROTECT(1);
+  return x_;
+}
 
 
-
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Read a double or complex vector
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+SEXP read_REALSXP(ctx_t *ctx, bool is_complex) {
+  
+  uint8_t method = read_uint8(ctx);
+  if (method == ZAP_CHUNKED) {
+    return read_REALSXP_chunked(ctx, is_complex);
+  }
+  
+  // Read the length and create an empty vector of the correct type
+  // 'len' is the number of doubles
+  size_t len = (size_t)read_len(ctx);
+  if (method & ZAP_ALIGNED) {
+    return is_complex ? read_aligned(ctx, CPLXSXP, len / 2) : read_aligned(ctx, REALSXP, len);
+  }
+  
+  SEXP x_;
+  if (is_complex) {
+    x_ = PROTECT(Rf_allocVector(CPLXSXP, (R_xlen_t)len / 2)); 
+  } else {
+    x_ = PROTECT(Rf_allocVector(REALSXP, (R_xlen_t)len)); 
+  }
+  
+  double *x = is_complex ? (double *)COMPLEX(x_) : REAL(x_);
+  read_REALSXP_ptr(ctx, method, x_, x, len);
+  
+  UNPROTECT(1);
+  return x_;
+}
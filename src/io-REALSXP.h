@@ -2,6 +2,4 @@
 void write_REALSXP(ctx_t *ctx, SEXP x_, bool is_complex);
 SEXP read_REALSXP(ctx_t *ctx, bool is_complex);
 
-
-void write_REALSXP_alp0(ctx_t *ctx, SEXP x_, bool is_complex);
-SEXP  read_REALSXP_alp0(ctx_t *ctx, bool is_complex);
+void write_REALSXP_ptr(ctx_t *ctx, double *x, size_t len, bool is_complex);
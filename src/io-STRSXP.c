@@ -206,8 +206,8 @@ SEXP read_STRSXP_mega(ctx_t *ctx) {
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // Read compressed char data
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  read_buf(ctx, BUF_RAW);
-  char *mega = (char *)ctx->buf[BUF_RAW];
+  size_t nbytes;
+  char *mega = (char *)borrow_buf(ctx, BUF_RAW, &nbytes, 1);
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // Partition the mega string into individual strings
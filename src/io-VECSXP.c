@@ -14,6 +14,8 @@
 #include "io-ctx.h"
 #include "io-core.h"
 #include "io-VECSXP.h"
+#include "io-frame.h"
+#include "io-index.h"
 
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -24,17 +26,37 @@
 //   length
 //   for each elem:
 //      write elem
+//
+// If this list has an index entry, each element gets an entry of its own
+// (see 'io-index.h')
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 void write_VECSXP_raw(ctx_t *ctx, SEXP x_) {
 
+  int64_t owner = index_owner(ctx, x_);
+
   write_uint8(ctx, VECSXP);
   R_xlen_t len = Rf_xlength(x_);
   write_len(ctx, (uint64_t)len);
   
+  if (owner < 0) {
+    for (R_xlen_t i = 0; i < len; i++) {
+      write_sexp(ctx, VECTOR_ELT(x_, i));
+    }
+    return;
+  }
+  
+  SEXP nms_ = PROTECT(Rf_getAttrib(x_, R_NamesSymbol));
   for (R_xlen_t i = 0; i < len; i++) {
-    write_sexp(ctx, VECTOR_ELT(x_, i));
+    SEXP el_ = VECTOR_ELT(x_, i);
+    SEXP name_ = Rf_isNull(nms_) ? NA_STRING : STRING_ELT(nms_, i);
+    int64_t entry = index_begin(ctx, owner, name_, el_);
+    write_sexp(ctx, el_);
+    index_end(ctx, entry);
   }
+  UNPROTECT(1);
   
+  // Attributes follow the last element
+  index_begin_attrs(ctx, owner);
 }
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -57,6 +79,7 @@ void write_VECSXP_reference(ctx_t *ctx, SEXP x_) {
     // Found the VECSXP in the cache
     write_uint8(ctx, VECSXP | 0x80); // set top bit to indicate reference 
     write_len(ctx, (uint64_t)hash_idx);
+    index_ref(ctx, ZAP_CACHE_VECSXP, hash_idx);
     return;
   }
   
@@ -0,0 +1,109 @@
+#define R_NO_REMAP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <R.h>
+#include <Rinternals.h>
+#include <Rdefines.h>
+
+#include "io-ctx.h"
+#include "io-align.h"
+#include "utils-altrep-mmap.h"
+
+#define HEADER_LEN 4
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Should a payload of 'nbytes' be aligned?
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+bool align_payload(ctx_t *ctx, size_t nbytes) {
+  return ctx->opts->align && nbytes >= ZAP_ALIGN_MIN;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Write [pad] [pad bytes] so that the next byte written is on a ZAP_ALIGN
+// boundary of the file
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void write_align_pad(ctx_t *ctx) {
+  static const uint8_t zeros[ZAP_ALIGN] = {0};
+
+  // File position after the 'pad' count has been written
+  size_t pos = HEADER_LEN + ctx->nwritten + (size_t)(ctx->wptr - ctx->stage) +
+    sizeof(uint16_t);
+  uint16_t pad = (uint16_t)((ZAP_ALIGN - pos % ZAP_ALIGN) % ZAP_ALIGN);
+
+  ctx_write(ctx, &pad, sizeof(uint16_t));
+  if (pad > 0) {
+    ctx_write(ctx, (void *)zeros, pad);
+  }
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Read an aligned payload i.e. everything after [len]
+//
+// If the source is a mapped file (see 'zap-mmap.c'), return a vector backed
+// by the mapping.  Otherwise allocate a vector and copy the data into it.
+//
+// @param type SEXPTYPE of the vector
+// @param len length of the R vector
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+SEXP read_aligned(ctx_t *ctx, SEXPTYPE type, size_t len) {
+
+  uint16_t pad = 0;
+  ctx_read(ctx, &pad, sizeof(uint16_t));
+  if (pad >= ZAP_ALIGN) {
+    Rf_error("read_aligned(): Padding out of range: %i", (int)pad);
+  }
+  if (pad <= (size_t)(ctx->rend - ctx->rptr)) {
+    ctx->rptr += pad;
+  } else {
+    uint8_t skip[ZAP_ALIGN];
+    ctx_read(ctx, skip, pad);
+  }
+
+  size_t elem_size;
+  switch(type) {
+  case INTSXP:
+    elem_size = sizeof(int32_t);
+    break;
+  case REALSXP:
+    elem_size = sizeof(double);
+    break;
+  case CPLXSXP:
+    elem_size = sizeof(Rcomplex);
+    break;
+  case RAWSXP:
+    elem_size = 1;
+    break;
+  default:
+    Rf_error("read_aligned(): Type not supported: %i", type);
+  }
+
+  if (len > (size_t)R_XLEN_T_MAX || len > SIZE_MAX / elem_size) {
+    Rf_error("read_aligned(): Length out of range: %.0f", (double)len);
+  }
+  size_t nbytes = len * elem_size;
+
+  // Data in the mapping is on a page boundary unless the file was not
+  // written as a single stream
+  if (ctx->map != NULL && nbytes <= (size_t)(ctx->rend - ctx->rptr) &&
+      ((uintptr_t)ctx->rptr % sizeof(Rcomplex)) == 0) {
+    SEXP x_ = wrap_mapped_vector(ctx->map, type, (R_xlen_t)len, ctx->rptr);
+    ctx->rptr += nbytes;
+    return x_;
+  }
+
+  SEXP x_ = PROTECT(Rf_allocVector(type, (R_xlen_t)len));
+  if (nbytes > 0) {
+    ctx_read(ctx, DATAPTR(x_), nbytes);
+  }
+  UNPROTECT(1);
+  return x_;
+}
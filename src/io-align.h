@@ -0,0 +1,34 @@
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Page-aligned payloads
+//
+// With option 'align', the bytes of large untransformed vectors (integer
+// and double vectors written with the 'raw' transform, and raw vectors)
+// are padded so they start on a ZAP_ALIGN boundary of the file.  These
+// bytes are exactly the contents of the R vector, so when an uncompressed
+// file is memory-mapped (see 'zap-mmap.c') the vector can be returned
+// backed by the mapping without copying or decoding.
+// See 'utils-altrep-mmap.c'
+//
+// Layout:
+//   INTSXP, REALSXP, CPLXSXP
+//     [SEXPTYPE] [method | ZAP_ALIGNED] [len] [pad] [pad bytes] [data]
+//   RAWSXP (which has no method byte)
+//     [RAWSXP | ZAP_ALIGNED] [len] [pad] [pad bytes] [data]
+//
+//   - 'len' is as for the unaligned method i.e. the number of doubles for
+//     REALSXP and CPLXSXP
+//   - 'pad' is the number of zero bytes which follow (uint16_t)
+//
+// Positions are relative to the start of the 4-byte header, i.e. the start
+// of a file, and are only known when encoding in order.  Vectors are not
+// chunked or encoded on worker threads when aligned.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#define ZAP_ALIGNED    0x40          // Flag on the method (or type) byte
+#define ZAP_ALIGN      4096          // Payloads start on this boundary
+#define ZAP_ALIGN_MIN  (16 * 1024)   // Smaller payloads are not padded
+
+bool align_payload(ctx_t *ctx, size_t nbytes);
+void write_align_pad(ctx_t *ctx);
+SEXP read_aligned(ctx_t *ctx, SEXPTYPE type, size_t len);
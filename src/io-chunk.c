@@ -0,0 +1,70 @@
+#define R_NO_REMAP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include <R.h>
+#include <Rinternals.h>
+#include <Rdefines.h>
+
+#include "io-ctx.h"
+#include "io-chunk.h"
+#include "io-LGLSXP.h"
+#include "io-INTSXP.h"
+#include "io-REALSXP.h"
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Write the header for a chunked vector.  
+// The caller then writes each chunk in order.
+//
+// @param sexptype LGLSXP, INTSXP, REALSXP or CPLXSXP
+// @param len length of the R vector
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void write_chunk_header(ctx_t *ctx, uint8_t sexptype, size_t len) {
+  write_uint8(ctx, sexptype);
+  write_uint8(ctx, ZAP_CHUNKED);
+  write_len(ctx, (uint64_t)len);
+  write_len(ctx, (uint64_t)ctx->opts->chunk_len);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Read the header for a chunked vector. 
+// The SEXPTYPE and ZAP_CHUNKED bytes have already been read.
+//
+// @param chunk_len number of R elements in each chunk
+// @return length of the R vector
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+size_t read_chunk_header(ctx_t *ctx, size_t *chunk_len) {
+  size_t len = (size_t)read_len(ctx);
+  *chunk_len = (size_t)read_len(ctx);
+  if (*chunk_len == 0) {
+    Rf_error("read_chunk_header(): Invalid chunk length");
+  }
+  return len;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Read a single chunk on its own i.e. a slice of a chunked vector.
+// A chunk is encoded like a vector, but is not followed by attributes
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+SEXP read_chunk(ctx_t *ctx) {
+  uint8_t type = (uint8_t)read_uint8(ctx);
+  switch(type) {
+  case LGLSXP:
+    return read_LGLSXP(ctx);
+  case INTSXP:
+    return read_INTSXP(ctx);
+  case REALSXP:
+    return read_REALSXP(ctx, false);
+  case CPLXSXP:
+    return read_REALSXP(ctx, true);
+  default:
+    Rf_error("read_chunk(): type not understood: %i", type);
+  }
+}
@@ -0,0 +1,37 @@
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Chunked vectors
+//
+// Logical, integer, double and complex vectors longer than the chunk length
+// (option 'row_group', default ZAP_CHUNK_LEN) are cut into chunks of that
+// many elements (the final chunk may be shorter).  Each chunk is encoded
+// independently, exactly as if it were a vector of its own, so that a 
+// single huge vector can be encoded and decoded by many threads.  
+// See 'io-plan.h' and 'io-decode.h'
+//
+// All columns of a data.frame are cut at the same rows, so each run of 
+// 'chunk_len' rows forms a row group.  With an index, the position of each
+// chunk is recorded so that a range of rows can be read without decoding
+// the rest of the column.  See 'io-index.h'
+//
+// Layout:
+//   [SEXPTYPE] [ZAP_CHUNKED] [len] [chunk_len] [chunk 0] [chunk 1] ...
+//
+//   - 'len' is the length of the R vector
+//   - 'chunk_len' is the number of R elements in each chunk
+//   - each chunk is a complete encoding of its slice of the vector i.e.
+//     [SEXPTYPE] [method] [len] [data ...]
+//
+// Chunking depends only on the length of the vector and the chunk length,
+// so the output is the same regardless of the number of threads.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#define ZAP_CHUNKED   0x80  // Method byte for a chunked vector
+#define ZAP_CHUNK_LEN (1024 * 1024)
+
+#define ZAP_CHUNK_LEN_MIN 1024
+#define ZAP_CHUNK_LEN_MAX (1024 * 1024 * 1024)
+
+void write_chunk_header(ctx_t *ctx, uint8_t sexptype, size_t len);
+size_t read_chunk_header(ctx_t *ctx, size_t *chunk_len);
+SEXP read_chunk(ctx_t *ctx);
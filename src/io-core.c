@@ -28,6 +28,7 @@
 
 #include "io-factor.h"
 #include "io-serialize.h"
+#include "io-plan.h"
 
 #include "utils-df.h"
 
@@ -138,6 +139,7 @@ void write_sexp(ctx_t *ctx, SEXP x_) {
   
   if (ctx->opts->verbosity & ZAP_VERBOSITY_OBJDF) {
     ctx->depth++;
+    ctx_flush(ctx); // ensure staged bytes are included in the position
     start = (int)get_position(ctx->user_data);
     obj_count = (int)ctx->obj_count++;
   }
@@ -152,6 +154,15 @@ void write_sexp(ctx_t *ctx, SEXP x_) {
     return;
   }
   
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Large atomic vectors may be left for a worker thread to encode. 
+  // See 'io-plan.h'
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  if (ctx->plan != NULL && plan_defer(ctx, x_)) {
+    write_attrs(ctx, x_);
+    return;
+  }
+  
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // Most things have attributes.
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -243,6 +254,7 @@ void write_sexp(ctx_t *ctx, SEXP x_) {
     }
     
     
+    ctx_flush(ctx);
     int end = (int)get_position(ctx->user_data);
     objdf_add_row(objdf_, obj_count, ctx->depth, TYPEOF(x_), start,
                   end, ALTREP(x_), used_rserialize, possibly_has_attrs);
@@ -293,7 +305,7 @@ SEXP read_sexp(ctx_t *ctx) {
     obj_ = PROTECT(read_REALSXP(ctx, true));
     break;
   case RAWSXP:
-    obj_ = PROTECT(read_RAWSXP(ctx));
+    obj_ = PROTECT(read_RAWSXP(ctx, type));
     break;
   case STRSXP:
     obj_ = PROTECT(read_STRSXP(ctx));
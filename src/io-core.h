@@ -1,3 +1,5 @@
-
 void write_sexp(ctx_t *ctx, SEXP x_);
 SEXP read_sexp(ctx_t *ctx);
+
+void write_attrs(ctx_t *ctx, SEXP x_);
+void read_attrs(ctx_t *ctx, SEXP obj_);
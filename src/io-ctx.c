@@ -8,6 +8,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <unistd.h>
+#include <stdarg.h>
 
 #include <R.h>
 #include <Rinternals.h>
@@ -15,6 +16,9 @@
 
 #include "io-ctx.h"
 #include "utils-df.h"
+#include "io-frame.h"
+#include "io-index.h"
+#include "io-chunk.h"
 
 //===========================================================================
 // Parse the R list of options into the 'opts_t' options struct
@@ -50,6 +54,16 @@ opts_t *parse_options(SEXP opts_) {
   opts->dbl_threshold =  0;
   opts->str_threshold =  0;
   
+  opts->frame          = ZAP_FRAME_OFF;
+  opts->frame_codec    = FRAME_CODEC_DEFLATE;
+  opts->frame_level    = FRAME_LEVEL_DEFAULT;
+  opts->block_size     = FRAME_BLOCK_SIZE_DEFAULT;
+  opts->nthreads       = 1;
+  opts->chunk_len      = ZAP_CHUNK_LEN;
+  opts->index          = false;
+  opts->align          = false;
+  opts->entropy        = false;
+  
   
   // Sanity check and extract option names from the named list
   if (Rf_isNull(opts_) || Rf_length(opts_) == 0) {
@@ -179,6 +193,68 @@ opts_t *parse_options(SEXP opts_) {
     } else if (strcmp(opt_name, "str_threshold") == 0) {
       opts->str_threshold = Rf_asInteger(val_); 
 
+    } else if (strcmp(opt_name, "frame") == 0) {
+      const char *val = CHAR(STRING_ELT(val_, 0));
+      opts->frame = ZAP_FRAME_ON;
+      if (strcmp(val, "none") == 0) {
+        opts->frame_codec = FRAME_CODEC_NONE;
+      } else if (strcmp(val, "deflate") == 0) {
+        opts->frame_codec = FRAME_CODEC_DEFLATE;
+      } else if (strcmp(val, "lz4") == 0) {
+        opts->frame_codec = FRAME_CODEC_LZ4;
+      } else {
+        Rf_warning("Option not understood: frame = '%s'. Using 'deflate'", val);
+        opts->frame_codec = FRAME_CODEC_DEFLATE;
+      }
+      
+    } else if (strcmp(opt_name, "level") == 0) {
+      int val = Rf_asInteger(val_);
+      if (val == NA_INTEGER || val < 1 || val > 9) {
+        Rf_warning("Option out of range: level = %i. Using the default", val);
+        opts->frame_level = FRAME_LEVEL_DEFAULT;
+      } else {
+        opts->frame_level = val;
+      }
+      
+    } else if (strcmp(opt_name, "block_size") == 0) {
+      double val = Rf_asReal(val_);
+      if (ISNAN(val) || val < FRAME_BLOCK_SIZE_MIN || val > FRAME_BLOCK_SIZE_MAX) {
+        Rf_warning("Option out of range: block_size = %.0f. Using %i", 
+                   val, FRAME_BLOCK_SIZE_DEFAULT);
+        opts->block_size = FRAME_BLOCK_SIZE_DEFAULT;
+      } else {
+        opts->block_size = (size_t)val;
+      }
+      
+    } else if (strcmp(opt_name, "threads") == 0) {
+      int val = Rf_asInteger(val_);
+      if (val == NA_INTEGER || val < 1) {
+        Rf_warning("Option out of range: threads = %i. Using 1", val);
+        val = 1;
+      } else if (val > POOL_MAX_THREADS) {
+        val = POOL_MAX_THREADS;
+      }
+      opts->nthreads = val;
+
+    } else if (strcmp(opt_name, "row_group") == 0) {
+      double val = Rf_asReal(val_);
+      if (ISNAN(val) || val < ZAP_CHUNK_LEN_MIN || val > ZAP_CHUNK_LEN_MAX) {
+        Rf_warning("Option out of range: row_group = %.0f. Using %i", 
+                   val, ZAP_CHUNK_LEN);
+        opts->chunk_len = ZAP_CHUNK_LEN;
+      } else {
+        opts->chunk_len = (size_t)val;
+      }
+      
+    } else if (strcmp(opt_name, "index") == 0) {
+      opts->index = Rf_asLogical(val_) == TRUE;
+
+    } else if (strcmp(opt_name, "align") == 0) {
+      opts->align = Rf_asLogical(val_) == TRUE;
+
+    } else if (strcmp(opt_name, "entropy") == 0) {
+      opts->entropy = Rf_asLogical(val_) == TRUE;
+
     } else {
       Rf_warning("Unknown option ignored: '%s'\n", opt_name);
     }
@@ -194,7 +270,7 @@ opts_t *parse_options(SEXP opts_) {
 // Expand a buffer - ignoring the current contents
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 void prepare_buf(ctx_t *ctx, int idx, size_t len) {
-  if (idx < 0 || idx >= CTX_NBUFS) Rf_error("buf idx out-of-range: %i", idx);
+  if (idx < 0 || idx >= CTX_NBUFS) ctx_error(ctx, "buf idx out-of-range: %i", idx);
   
   if (len <= ctx->bufsize[idx]) {
     return;
@@ -205,7 +281,7 @@ void prepare_buf(ctx_t *ctx, int idx, size_t len) {
   ctx->buf[idx]  = malloc(ctx->bufsize[idx]);
   
   if (ctx->buf[idx] == NULL) {
-    Rf_error("prepare_buf(): Couldn't prepare ctx->buf[%i] with %li", idx, (long)len);
+    ctx_error(ctx, "prepare_buf(): Couldn't prepare ctx->buf[%i] with %li", idx, (long)len);
   }
 }
 
@@ -214,7 +290,7 @@ void prepare_buf(ctx_t *ctx, int idx, size_t len) {
 // Re-allocate a buffer - preserving the contents
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 void realloc_buf(ctx_t *ctx, int idx, size_t len) {
-  if (idx < 0 || idx >= CTX_NBUFS) Rf_error("buf idx out-of-range: %i", idx);
+  if (idx < 0 || idx >= CTX_NBUFS) ctx_error(ctx, "buf idx out-of-range: %i", idx);
   
   if (len <= ctx->bufsize[idx]) {
     return;
@@ -224,7 +300,7 @@ void realloc_buf(ctx_t *ctx, int idx, size_t len) {
   ctx->buf[idx] = realloc(ctx->buf[idx], ctx->bufsize[idx]);
   
   if (ctx->buf[idx] == NULL) {
-    Rf_error("realloc_buf(): Couldn't re-allocate ctx->buf");
+    ctx_error(ctx, "realloc_buf(): Couldn't re-allocate ctx->buf");
   }
 }
 
@@ -241,7 +317,7 @@ void write_buf(ctx_t *ctx, int buf_idx, size_t len) {
   write_len(ctx, len);
   
   if (len > 0) {
-    ctx->write(ctx->user_data, ctx->buf[buf_idx], len);
+    ctx_write(ctx, ctx->buf[buf_idx], len);
   }
 }
 
@@ -252,7 +328,7 @@ size_t read_buf(ctx_t *ctx, int buf_idx) {
   
   // Ensure there's enough room in the buffer to read the data
   prepare_buf(ctx, buf_idx, len);
-  ctx->read(ctx->user_data, ctx->buf[buf_idx], len);
+  ctx_read(ctx, ctx->buf[buf_idx], len);
   
   return len;
 }
@@ -260,6 +336,57 @@ size_t read_buf(ctx_t *ctx, int buf_idx) {
 
 
 
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Borrow a buffer written with 'write_buf()'
+//
+// If the source is memory-backed (see 'ctx_set_read_window()'), return a 
+// pointer directly into the source data and avoid copying. Otherwise (or if 
+// the source pointer is not aligned to 'align' bytes) the data is copied into 
+// 'ctx->buf[buf_idx]' and that is returned instead.
+//
+// The returned data must be treated as read-only.
+//
+// @param len Number of bytes in the returned buffer
+// @param align required alignment of the returned pointer e.g. 
+//        'sizeof(uint64_t)' if the data will be accessed as uint64_t
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+uint8_t *borrow_buf(ctx_t *ctx, int buf_idx, size_t *len, size_t align) {
+  
+  *len = read_len(ctx);
+  if (*len == 0) return ctx->buf[buf_idx];
+  
+  if (*len <= (size_t)(ctx->rend - ctx->rptr) && ((uintptr_t)ctx->rptr % align) == 0) {
+    uint8_t *p = ctx->rptr;
+    ctx->rptr += *len;
+    return p;
+  }
+  
+  prepare_buf(ctx, buf_idx, *len);
+  ctx_read(ctx, ctx->buf[buf_idx], *len);
+  
+  return ctx->buf[buf_idx];
+}
+
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Ensure data is aligned to 'align' bytes. 
+// If it is not, copy it into 'ctx->buf[buf_idx]' and return that instead.
+//
+// For data borrowed with 'align = 1' and decoded later. See 'io-decode.h'
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void *align_ptr(ctx_t *ctx, int buf_idx, void *src, size_t len, size_t align) {
+  if (((uintptr_t)src % align) == 0) {
+    return src;
+  }
+  
+  prepare_buf(ctx, buf_idx, len);
+  memcpy(ctx->buf[buf_idx], src, len);
+  return ctx->buf[buf_idx];
+}
+
+
+
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // Read/Write from ptr 
 //
@@ -271,7 +398,7 @@ void write_ptr(ctx_t *ctx, void *ptr, size_t len) {
   write_len(ctx, len);
   
   if (len > 0) {
-    ctx->write(ctx->user_data, ptr, len);
+    ctx_write(ctx, ptr, len);
   }
 }
 
@@ -280,7 +407,7 @@ size_t read_ptr(ctx_t *ctx, void *ptr) {
   size_t len = read_len(ctx);
   if (len == 0) return 0;
   
-  ctx->read(ctx->user_data, ptr, len);
+  ctx_read(ctx, ptr, len);
   
   return len;
 }
@@ -291,12 +418,12 @@ size_t read_ptr(ctx_t *ctx, void *ptr) {
 // Read/Write a single signed int32
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 void write_int32(ctx_t *ctx, int32_t val) {
-  ctx->write(ctx->user_data, &val, sizeof(int32_t));
+  ctx_write(ctx, &val, sizeof(int32_t));
 }
 
 int32_t read_int32(ctx_t *ctx) {
   int32_t val = 0;  
-  ctx->read(ctx->user_data, &val, sizeof(int32_t));
+  ctx_read(ctx, &val, sizeof(int32_t));
   return val;
 }
 
@@ -306,13 +433,65 @@ int32_t read_int32(ctx_t *ctx) {
 // Read/Write a single byte
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 void write_uint8(ctx_t *ctx, uint8_t val) {
-  ctx->write(ctx->user_data, &val, sizeof(uint8_t));
+  put_u8(ctx, val);
 }
 
 uint8_t read_uint8(ctx_t *ctx) {
-  uint8_t val = 0;  
-  ctx->read(ctx->user_data, &val, sizeof(uint8_t));
-  return val;
+  return get_u8(ctx);
+}
+
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Pass all staged bytes to the 'write()' callback
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void ctx_flush(ctx_t *ctx) {
+  if (ctx->wptr > ctx->stage) {
+    ctx->write(ctx->user_data, ctx->stage, (size_t)(ctx->wptr - ctx->stage));
+    ctx->nwritten += (size_t)(ctx->wptr - ctx->stage);
+    ctx->wptr = ctx->stage;
+  }
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Slow path for 'ctx_write()' when the stage does not have enough room.
+// Large writes are passed straight to the 'write()' callback
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void ctx_write_slow(ctx_t *ctx, void *buf, size_t len) {
+  ctx_flush(ctx);
+  
+  if (len >= CTX_STAGE_SIZE / 2) {
+    ctx->write(ctx->user_data, buf, len);
+    ctx->nwritten += len;
+  } else {
+    memcpy(ctx->wptr, buf, len);
+    ctx->wptr += len;
+  }
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Slow path for 'ctx_read()' when the read window does not hold enough bytes.
+// Sources without a read window always come here.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void ctx_read_slow(ctx_t *ctx, void *buf, size_t len) {
+  if (ctx->rend != NULL) {
+    Rf_error("ctx_read(): Read out-of-bounds. Wanted %li bytes. Only %li remain", 
+             (long)len, (long)(ctx->rend - ctx->rptr));
+  }
+  ctx->read(ctx->user_data, buf, len);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Give the context direct access to the entire input.
+// All reads will be served from this memory. The 'read()' callback is 
+// not used.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void ctx_set_read_window(ctx_t *ctx, uint8_t *data, size_t len) {
+  ctx->rptr = data;
+  ctx->rend = data + len;
 }
 
 
@@ -438,6 +617,54 @@ ctx_t *create_serialize_ctx(void *user_data,
   ctx->user_data = user_data; // The user's data passed to the 'write()' callback
   ctx->write     = write;     // The write callback
   
+  // Staging buffer for small writes
+  ctx->stage = malloc(CTX_STAGE_SIZE);
+  if (ctx->stage == NULL) {
+    Rf_error("create_serialize_ctx(): Couldn't allocate ctx->stage");
+  }
+  ctx->wptr = ctx->stage;
+  ctx->wend = ctx->stage + CTX_STAGE_SIZE;
+  
+  return ctx;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Create a context for encoding atomic vectors on a worker thread
+// - must be called on the main thread
+// - no R objects are allocated, and there is no cache of environments or
+//   lists
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ctx_t *create_worker_ctx(void *user_data, 
+                         void    (*write)(void *user_data, void *buf, size_t len),
+                         opts_t *opts) {
+  
+  ctx_t *ctx = calloc(1, sizeof(ctx_t));
+  if (ctx == NULL) {
+    Rf_error("create_worker_ctx(): Couldn't allocate ctx");
+  }
+  ctx->opts      = opts;
+  ctx->cache     = NULL;
+  ctx->user_data = user_data;
+  ctx->write     = write;
+  
+  for (int i = 0; i < CTX_NBUFS; i++) {
+    ctx->bufsize[i] = INIT_BUFSIZE;
+    ctx->buf[i]     = malloc(ctx->bufsize[i]);
+    if (ctx->buf[i] == NULL) {
+      ctx_destroy(ctx);
+      Rf_error("create_worker_ctx(): Couldn't allocate ctx->buf");
+    }
+  }
+  
+  ctx->stage = malloc(CTX_STAGE_SIZE);
+  if (ctx->stage == NULL) {
+    ctx_destroy(ctx);
+    Rf_error("create_worker_ctx(): Couldn't allocate ctx->stage");
+  }
+  ctx->wptr = ctx->stage;
+  ctx->wend = ctx->stage + CTX_STAGE_SIZE;
+  
   return ctx;
 }
 
@@ -470,8 +697,9 @@ void ctx_destroy(ctx_t *ctx) {
   for (int i = 0; i < CTX_NBUFS; i++) {
     free(ctx->buf[i]);
   }
+  free(ctx->stage);
   
-  if (ctx->opts->verbosity == 16) {
+  if (ctx->opts->verbosity == 16 && ctx->envsxp_hashmap != NULL) {
     Rprintf("Env Hashmap ------------------\nTotal Items = %i\n", 
             (int)ctx->envsxp_hashmap->total_items);
     for (int i = 0; i < ctx->envsxp_hashmap->nbuckets; i++) {
@@ -483,12 +711,38 @@ void ctx_destroy(ctx_t *ctx) {
   }
   mph_destroy(ctx->envsxp_hashmap);
   mph_destroy(ctx->vecsxp_hashmap);
+  index_destroy(ctx->index);
   
-  R_ReleaseObject(ctx->cache); // R object cache
+  if (ctx->cache != NULL) {
+    R_ReleaseObject(ctx->cache); // R object cache
+  }
   free(ctx);
 }
 
 
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Raise an error.
+// On a worker thread R's API cannot be called, so the message is stored
+// and control returns to the 'setjmp()' in the worker. The main thread 
+// raises the error once all workers are done.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void ctx_error(ctx_t *ctx, const char *fmt, ...) {
+  char msg[sizeof(ctx->err_msg)];
+  
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(msg, sizeof(msg), fmt, args);
+  va_end(args);
+  
+  if (ctx->err_jmp != NULL) {
+    memcpy(ctx->err_msg, msg, sizeof(msg));
+    longjmp(*ctx->err_jmp, 1);
+  }
+  
+  Rf_error("%s", msg);
+}
+
+
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // Character strings used for verbose output
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
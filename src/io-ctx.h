@@ -2,6 +2,9 @@
 // Hashmap
 #include "mph.h"
 
+// Error handling on worker threads
+#include <setjmp.h>
+
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // Version of set of internal transformations
 // Anytime a transformation changes or is added, bump this version by 1
@@ -16,8 +19,35 @@
 //      - bit0 is used to indicate if the encoded stream uses VECSXP 
 //        references
 //   - flag2 is unused.
+// Version 3
+//   - v0.1.1.9009 2026-10-18
+//   - flag2
+//      - bit0 indicates the stream is cut into independently compressed 
+//        blocks. See 'io-frame.h'
+//   - Unframed version 3 streams are identical to version 2
+// Version 4
+//   - v0.1.1.9013 2026-10-18
+//   - logical, integer, double and complex vectors longer than 
+//     ZAP_CHUNK_LEN are written as independently encoded chunks. 
+//     See 'io-chunk.h'
+// Version 5
+//   - v0.1.1.9015 2026-10-18
+//   - flag2
+//      - bit1 indicates an index of list elements follows the stream.
+//        See 'io-index.h'
+//   - Streams without an index are identical to version 4
+// Version 6
+//   - v0.1.1.9023 2026-10-18
+//   - bit6 of the method byte (or of the type byte of a raw vector) 
+//     indicates the data is aligned to a page boundary. See 'io-align.h'
+//   - Streams written without option 'align' are identical to version 5
+// Version 7
+//   - v0.1.1.9025 2026-10-18
+//   - bit5 of the method byte of a shuffled double or integer vector 
+//     indicates its shuffled bytes are entropy coded. See 'utils-rans.h'
+//   - Streams written without option 'entropy' are identical to version 6
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-#define ZAP_VERSION 2
+#define ZAP_VERSION 7
 
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -59,6 +89,9 @@
 #define ZAP_VEC_RAW        0  // Write all VECXXP as they are encountered
 #define ZAP_VEC_REF        1  // Cache VECSXPs and write references for duplicates
 
+#define ZAP_FRAME_OFF      0  // A single unframed stream
+#define ZAP_FRAME_ON       1  // Independently compressed blocks
+
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // Cache contents
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -87,6 +120,21 @@ typedef struct {
   int fct_threshold;
   int dbl_threshold;
   int str_threshold;
+  
+  int frame;          // ZAP_FRAME_OFF, ZAP_FRAME_ON
+  int frame_codec;    // Codec for each block. See 'io-frame.h'
+  int frame_level;    // Compression level for the codec
+  size_t block_size;  // Uncompressed size of each block
+  
+  int nthreads;       // Threads for encoding and block compression
+  
+  size_t chunk_len;   // Elements in each chunk of a long vector. See 'io-chunk.h'
+  
+  int index;          // Append an index of list elements. See 'io-index.h'
+  
+  int align;          // Page-align untransformed payloads. See 'io-align.h'
+  
+  int entropy;        // Entropy code shuffled bytes. See 'utils-rans.h'
 } opts_t;
 
 
@@ -121,6 +169,25 @@ typedef struct {
   void (*write) (void *user_data, void *buf, size_t len);
   void (*read)  (void *user_data, void *buf, size_t len);
   
+  // Staging buffer for writes. Bytes in [stage, wptr) have not yet
+  // been passed to the 'write()' callback
+  uint8_t *stage;
+  uint8_t *wptr;
+  uint8_t *wend;
+  
+  // Total bytes passed to the 'write()' callback
+  size_t nwritten;
+  
+  // Read window for memory-backed sources. Bytes in [rptr, rend) are
+  // read directly without calling the 'read()' callback.
+  uint8_t *rptr;
+  uint8_t *rend;
+  
+  // External pointer owning a mapping of the source file. Aligned payloads
+  // are returned as vectors backed by it. See 'io-align.h'
+  // NULL when not reading from a mapped file
+  SEXP map;
+  
   // Storage and tracking for verbose output
   int depth;            // tracking depth for tree printing
   size_t obj_count;  
@@ -128,6 +195,24 @@ typedef struct {
   
   // User options
   opts_t *opts;
+  
+  // Atomic vectors deferred for parallel encoding. See 'io-plan.h'
+  // NULL when encoding everything in order
+  struct plan_s *plan;
+  
+  // Decode jobs deferred for parallel decoding. See 'io-decode.h'
+  // NULL when decoding everything in order
+  struct decoder_s *decoder;
+  
+  // Positions of list elements being recorded. See 'io-index.h'
+  // NULL when not writing an index
+  struct index_s *index;
+  
+  // Contexts used on worker threads set 'err_jmp'.  'ctx_error()' then 
+  // records the message in 'err_msg' and jumps back to the worker rather
+  // than calling 'Rf_error()'
+  jmp_buf *err_jmp;
+  char err_msg[256];
 } ctx_t;
 
 
@@ -145,11 +230,26 @@ ctx_t *create_unserialize_ctx(void *user_data,
                               void    (*read)(void *user_data, void *buf, size_t len),
                               opts_t *opts);
 
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Create a serialization context for use on a worker thread.
+// It has scratch buffers and a stage, but no R object cache, so it can 
+// only be used to write atomic vectors.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ctx_t *create_worker_ctx(void *user_data, 
+                         void    (*write)(void *user_data, void *buf, size_t len),
+                         opts_t *opts);
+
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // Destroy the context and all allocated memory. Release any cached R objects
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 void ctx_destroy(ctx_t *ctx);
 
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Raise an error from code which may run on a worker thread.
+// Calls 'Rf_error()' unless 'ctx->err_jmp' is set
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void ctx_error(ctx_t *ctx, const char *fmt, ...) __attribute__((noreturn));
+
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // New SEXPs to take care of special cases.
@@ -175,6 +275,8 @@ void realloc_buf(ctx_t *ctx, int idx, size_t len);
 
 void write_buf(ctx_t *ctx, int buf_idx, size_t len);
 size_t read_buf(ctx_t *ctx, int buf_idx);
+uint8_t *borrow_buf(ctx_t *ctx, int buf_idx, size_t *len, size_t align);
+void *align_ptr(ctx_t *ctx, int buf_idx, void *src, size_t len, size_t align);
 
 void write_ptr(ctx_t *ctx, void *ptr, size_t len);
 size_t read_ptr(ctx_t *ctx, void *ptr);
@@ -185,6 +287,61 @@ int32_t read_int32(ctx_t *ctx);
 void write_uint8(ctx_t *ctx, uint8_t val);
 uint8_t read_uint8(ctx_t *ctx);
 
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Staged writes and windowed reads
+//
+// Small writes are gathered in 'ctx->stage' and only passed to the user's 
+// 'write()' callback in large chunks.  Writes larger than the stage bypass 
+// it. 'ctx_flush()' must be called once serialization is complete.
+//
+// A memory-backed source can give its entire contents to the context with
+// 'ctx_set_read_window()'.  Reads are then served straight from this 
+// memory, and 'borrow_buf()' can return pointers into it. This memory must
+// remain valid for the lifetime of the context.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#define CTX_STAGE_SIZE (64 * 1024)
+
+void ctx_flush(ctx_t *ctx);
+void ctx_set_read_window(ctx_t *ctx, uint8_t *data, size_t len);
+
+void ctx_write_slow(ctx_t *ctx, void *buf, size_t len);
+void ctx_read_slow (ctx_t *ctx, void *buf, size_t len);
+
+static inline void ctx_write(ctx_t *ctx, void *buf, size_t len) {
+  if (len <= (size_t)(ctx->wend - ctx->wptr)) {
+    memcpy(ctx->wptr, buf, len);
+    ctx->wptr += len;
+  } else {
+    ctx_write_slow(ctx, buf, len);
+  }
+}
+
+static inline void ctx_read(ctx_t *ctx, void *buf, size_t len) {
+  if (len <= (size_t)(ctx->rend - ctx->rptr)) {
+    memcpy(buf, ctx->rptr, len);
+    ctx->rptr += len;
+  } else {
+    ctx_read_slow(ctx, buf, len);
+  }
+}
+
+static inline void put_u8(ctx_t *ctx, uint8_t val) {
+  if (ctx->wptr < ctx->wend) {
+    *ctx->wptr++ = val;
+  } else {
+    ctx_write_slow(ctx, &val, 1);
+  }
+}
+
+static inline uint8_t get_u8(ctx_t *ctx) {
+  if (ctx->rptr < ctx->rend) {
+    return *ctx->rptr++;
+  } 
+  uint8_t val = 0;
+  ctx_read_slow(ctx, &val, 1);
+  return val;
+}
+
 // For read_len()/write_len()
 #include "utils-varint.h"
 
@@ -0,0 +1,184 @@
+#define R_NO_REMAP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <R.h>
+#include <Rinternals.h>
+#include <Rdefines.h>
+
+#include "io-ctx.h"
+#include "io-decode.h"
+
+
+static void decoder_finalizer(SEXP guard_) {
+  decoder_destroy((decoder_t *)R_ExternalPtrAddr(guard_));
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Create a decoder
+// The caller must PROTECT 'decoder->guard_'
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+decoder_t *decoder_create(opts_t *opts) {
+
+  decoder_t *decoder = calloc(1, sizeof(decoder_t));
+  if (decoder == NULL) Rf_error("decoder_create(): malloc failed");
+
+  decoder->capacity = 64;
+  decoder->jobs     = calloc(decoder->capacity, sizeof(decode_job_t));
+
+  decoder->nthreads = opts->nthreads;
+  decoder->workers  = calloc((size_t)decoder->nthreads, sizeof(ctx_t *));
+
+  if (decoder->jobs == NULL || decoder->workers == NULL) {
+    decoder_destroy(decoder);
+    Rf_error("decoder_create(): malloc failed");
+  }
+
+  decoder->guard_ = PROTECT(R_MakeExternalPtr(decoder, R_NilValue, R_NilValue));
+  R_RegisterCFinalizerEx(decoder->guard_, decoder_finalizer, TRUE);
+  decoder->keep_ = Rf_allocVector(VECSXP, (R_xlen_t)decoder->capacity);
+  R_SetExternalPtrProtected(decoder->guard_, decoder->keep_);
+
+  for (int i = 0; i < decoder->nthreads; i++) {
+    decoder->workers[i] = create_worker_ctx(NULL, NULL, opts);
+  }
+  UNPROTECT(1);
+
+  return decoder;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Run a decode job now, or keep it for 'decoder_run()'
+//
+// @param x_ the vector which 'job->dst' belongs to
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void decode_submit(ctx_t *ctx, SEXP x_, decode_job_t *job) {
+  decoder_t *decoder = ctx->decoder;
+
+  if (decoder == NULL || ctx->rend == NULL || job->len < DECODE_MIN_LEN) {
+    job->fn(ctx, job);
+    return;
+  }
+
+  if (decoder->njobs == decoder->capacity) {
+    size_t new_capacity = decoder->capacity * 2;
+    decode_job_t *new_jobs = realloc(decoder->jobs, new_capacity * sizeof(decode_job_t));
+    if (new_jobs == NULL) Rf_error("decode_submit(): malloc failed");
+    decoder->jobs = new_jobs;
+
+    SEXP keep_ = PROTECT(Rf_allocVector(VECSXP, (R_xlen_t)new_capacity));
+    for (size_t i = 0; i < decoder->njobs; i++) {
+      SET_VECTOR_ELT(keep_, (R_xlen_t)i, VECTOR_ELT(decoder->keep_, (R_xlen_t)i));
+    }
+    R_SetExternalPtrProtected(decoder->guard_, keep_);
+    decoder->keep_ = keep_;
+    UNPROTECT(1);
+
+    decoder->capacity = new_capacity;
+  }
+
+  SET_VECTOR_ELT(decoder->keep_, (R_xlen_t)decoder->njobs, x_);
+  decoder->jobs[decoder->njobs++] = *job;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Pool task. Each task has its own worker context and claims jobs
+// until none remain.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void decode_task(void *arg, size_t idx) {
+  decoder_t *decoder = (decoder_t *)arg;
+  ctx_t     *ctx     = decoder->workers[idx];
+  jmp_buf env;
+
+  ctx->err_jmp = &env;
+  if (setjmp(env) != 0) {
+    bool expected = false;
+    if (__atomic_compare_exchange_n(&decoder->failed, &expected, true, false,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      memcpy(decoder->err_msg, ctx->err_msg, sizeof(decoder->err_msg));
+    }
+    ctx->err_jmp = NULL;
+    return;
+  }
+
+  while (true) {
+    size_t i = __atomic_fetch_add(&decoder->next, 1, __ATOMIC_RELAXED);
+    if (i >= decoder->njobs || __atomic_load_n(&decoder->failed, __ATOMIC_RELAXED)) {
+      break;
+    }
+    decode_job_t *job = &decoder->jobs[i];
+    job->fn(ctx, job);
+  }
+
+  ctx->err_jmp = NULL;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Largest jobs first, so that threads finish at about the same time
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static int cmp_job_len(const void *a, const void *b) {
+  size_t len_a = ((const decode_job_t *)a)->len;
+  size_t len_b = ((const decode_job_t *)b)->len;
+  return (len_a < len_b) - (len_a > len_b);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Run all deferred jobs in parallel.
+// Every vector which was read is complete once this returns.
+// If a job fails, the decoder is destroyed before the error is raised.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void decoder_run(decoder_t *decoder) {
+  if (decoder->njobs == 0) return;
+
+  qsort(decoder->jobs, decoder->njobs, sizeof(decode_job_t), cmp_job_len);
+
+  decoder->next   = 0;
+  decoder->failed = false;
+  size_t ntasks = (size_t)decoder->nthreads;
+  if (ntasks > decoder->njobs) ntasks = decoder->njobs;
+
+  // The pool only lives for this run so that no threads are left behind
+  // if an R error is raised before the decoder is destroyed
+  pool_t *pool = pool_create((int)ntasks);
+  pool_run(pool, ntasks, decode_task, decoder);
+  pool_destroy(pool);
+
+  decoder->njobs = 0;
+  if (decoder->failed) {
+    char err_msg[256];
+    memcpy(err_msg, decoder->err_msg, sizeof(err_msg));
+    decoder_destroy(decoder);
+    Rf_error("%s", err_msg);
+  }
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Free the decoder. Any pending jobs are discarded
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void decoder_destroy(decoder_t *decoder) {
+  if (decoder == NULL) return;
+
+  if (decoder->workers != NULL) {
+    for (int i = 0; i < decoder->nthreads; i++) {
+      ctx_destroy(decoder->workers[i]);
+    }
+    free(decoder->workers);
+  }
+  if (decoder->guard_ != NULL) {
+    R_SetExternalPtrProtected(decoder->guard_, R_NilValue);
+    R_ClearExternalPtr(decoder->guard_);
+  }
+  free(decoder->jobs);
+  free(decoder);
+}
@@ -0,0 +1,82 @@
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Parallel decoding of atomic vectors
+//
+// Readers for transformed logical, integer and double vectors are split
+// in two:
+//   - 'read_*()' runs on the main thread. It parses the stream, allocates
+//     the R vector and records where the encoded data is in a decode job
+//   - the job's 'fn()' is the pure C decode kernel which fills in the
+//     vector's data.  It makes no R API calls.
+//
+// Jobs are passed to 'decode_submit()'. With a single thread (or for
+// short vectors) the job is run immediately.  Otherwise the job is kept
+// and all jobs are run in parallel by 'decoder_run()' once the whole
+// object has been read.
+//
+// Deferral requires the source to be memory-backed (see
+// 'ctx_set_read_window()') so that pointers to encoded data remain valid.
+// Encoded data is borrowed with 'align = 1', and kernels use 'align_ptr()'
+// to get aligned copies if needed.
+//
+// The decoder owns worker contexts and the deferred vectors, so it is tied
+// to 'guard_' - an external pointer whose finalizer destroys it.  The 
+// caller must PROTECT 'guard_' so that if an R error is raised before 
+// 'decoder_destroy()' (e.g. corrupt data or an interrupt) everything is 
+// released once the guard is garbage collected.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#include "utils-pool.h"
+
+#define DECODE_MIN_LEN 1024
+#define DECODE_NSRC    3
+
+typedef struct decode_job_s decode_job_t;
+
+struct decode_job_s {
+  // Decode kernel
+  void (*fn)(ctx_t *ctx, decode_job_t *job);
+
+  // Destination. The data of an R vector
+  void *dst;
+  size_t len;
+
+  // Encoded data
+  uint8_t *src[DECODE_NSRC];
+  size_t nsrc[DECODE_NSRC];
+
+  // Parameters for particular kernels
+  int32_t ref;
+  int32_t delta_offset;
+  size_t nbits;
+  size_t npatch;
+  uint8_t e;
+  uint8_t f;
+  bool entropy;  // Shuffled bytes are entropy coded. See 'utils-rans.h'
+};
+
+
+typedef struct decoder_s {
+  decode_job_t *jobs;
+  size_t njobs;
+  size_t capacity;
+
+  // Deferred vectors are held here so they remain protected until
+  // they are decoded.  'keep_' is protected by 'guard_'
+  SEXP keep_;
+  SEXP guard_;
+
+  // Next job to be claimed by a worker
+  size_t next;
+  bool failed;
+  char err_msg[256];
+
+  int nthreads;
+  ctx_t **workers;
+} decoder_t;
+
+
+decoder_t *decoder_create(opts_t *opts);
+void decode_submit(ctx_t *ctx, SEXP x_, decode_job_t *job);
+void decoder_run(decoder_t *decoder);
+void decoder_destroy(decoder_t *decoder);
@@ -129,14 +129,15 @@ SEXP read_factor(ctx_t *ctx) {
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // Read the compressed data and decompress
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  read_buf(ctx, BUF_PACKED);
+  size_t nbytes;
+  uint8_t *packed = borrow_buf(ctx, BUF_PACKED, &nbytes, sizeof(uint64_t));
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // Unpack the integers
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  unpack_nbits_buf_ptr(
+  unpack_nbits_ptr_ptr(
     ctx, 
-    BUF_PACKED,               // source (packed)
+    packed,                   // source (packed)
     (uint32_t *)INTEGER(x_),  // dest   (unpacked)
     len,                      // number of packed ints
     nbits                     // number of bits per int
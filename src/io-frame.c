@@ -0,0 +1,659 @@
+#define R_NO_REMAP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+#include <R.h>
+#include <Rinternals.h>
+#include <Rdefines.h>
+
+#include "io-ctx.h"
+#include "io-frame.h"
+#include "utils-lz4.h"
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Little-endian uint32 to/from bytes
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void put_u32le(uint8_t *p, uint32_t val) {
+  p[0] = (uint8_t)(val      );
+  p[1] = (uint8_t)(val >>  8);
+  p[2] = (uint8_t)(val >> 16);
+  p[3] = (uint8_t)(val >> 24);
+}
+
+static uint32_t get_u32le(uint8_t *p) {
+  return
+    ((uint32_t)p[0]      ) |
+    ((uint32_t)p[1] <<  8) |
+    ((uint32_t)p[2] << 16) |
+    ((uint32_t)p[3] << 24);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Decode a block header
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void parse_frame_header(uint8_t *hdr, int *codec, size_t *ulen, size_t *clen) {
+  *codec = hdr[0];
+  *ulen  = get_u32le(hdr + 1);
+  *clen  = get_u32le(hdr + 5);
+
+  if (*codec != FRAME_CODEC_NONE && *codec != FRAME_CODEC_DEFLATE && 
+      *codec != FRAME_CODEC_LZ4) {
+    Rf_error("Unknown frame codec: %i", *codec);
+  }
+  if (*ulen > FRAME_BLOCK_SIZE_MAX) {
+    Rf_error("Frame block too large: %.0f bytes", (double)*ulen);
+  }
+  if (*codec == FRAME_CODEC_NONE && *clen != *ulen) {
+    Rf_error("Corrupt frame header. Stored block with mismatched lengths");
+  }
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Decompress a single block
+// @return true on success
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static bool decode_block(int codec, uint8_t *src, size_t clen, uint8_t *dst, size_t ulen) {
+
+  if (codec == FRAME_CODEC_NONE) {
+    memcpy(dst, src, ulen);
+    return true;
+  }
+
+  if (codec == FRAME_CODEC_LZ4) {
+    return lz4_decompress_ptr_ptr(src, clen, dst, ulen);
+  }
+
+  uLongf dlen = (uLongf)ulen;
+  int status = uncompress(dst, &dlen, src, (uLong)clen);
+  return status == Z_OK && dlen == ulen;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+//  Frame Writer
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+static void frame_writer_finalizer(SEXP guard_) {
+  frame_writer_destroy((frame_writer_t *)R_ExternalPtrAddr(guard_));
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Create a frame writer which passes compressed blocks to 'write()'
+// The caller must PROTECT 'fw->guard_'
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+frame_writer_t *frame_writer_create(void *user_data,
+                                    void (*write)(void *user_data, void *buf, size_t len),
+                                    opts_t *opts) {
+
+  frame_writer_t *fw = calloc(1, sizeof(frame_writer_t));
+  if (fw == NULL) Rf_error("frame_writer_create(): malloc failed");
+
+  fw->user_data  = user_data;
+  fw->write      = write;
+  fw->codec      = opts->frame_codec;
+  fw->level      = opts->frame_level;
+  fw->block_size = opts->block_size;
+  fw->nslots     = opts->nthreads > 1 ? (size_t)opts->nthreads * FRAME_BATCH : 1;
+  fw->ccapacity  = compressBound((uLong)fw->block_size);
+
+  bool ok = true;
+  for (int i = 0; i < 2; i++) {
+    frame_wbatch_t *batch = &fw->batch[i];
+    batch->block  = malloc(fw->nslots * fw->block_size);
+    batch->cbuf   = malloc(fw->nslots * fw->ccapacity);
+    batch->clen   = calloc(fw->nslots, sizeof(size_t));
+    batch->ccodec = calloc(fw->nslots, sizeof(int));
+    if (batch->block == NULL || batch->cbuf == NULL || 
+        batch->clen == NULL || batch->ccodec == NULL) {
+      ok = false;
+    }
+  }
+  if (!ok) {
+    frame_writer_destroy(fw);
+    Rf_error("frame_writer_create(): malloc failed");
+  }
+
+  fw->guard_ = PROTECT(R_MakeExternalPtr(fw, R_NilValue, R_NilValue));
+  R_RegisterCFinalizerEx(fw->guard_, frame_writer_finalizer, TRUE);
+  UNPROTECT(1);
+
+  // One worker per thread.  The main thread keeps serializing
+  fw->pool = pool_create(opts->nthreads + 1);
+
+  return fw;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Compress a single block of the batch with the workers.
+// Blocks which do not compress are marked to be stored as-is
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void compress_task(void *arg, size_t idx) {
+  frame_writer_t *fw = (frame_writer_t *)arg;
+  frame_wbatch_t *batch = &fw->batch[1 - fw->cur];
+
+  uint8_t *src = batch->block + idx * fw->block_size;
+  size_t len = batch->len - idx * fw->block_size;
+  if (len > fw->block_size) len = fw->block_size;
+
+  batch->ccodec[idx] = FRAME_CODEC_NONE;
+  batch->clen[idx]   = len;
+
+  if (fw->codec == FRAME_CODEC_DEFLATE) {
+    uLongf dlen = (uLongf)fw->ccapacity;
+    int level = fw->level == FRAME_LEVEL_DEFAULT ? Z_DEFAULT_COMPRESSION : fw->level;
+    int status = compress2(batch->cbuf + idx * fw->ccapacity, &dlen, src, (uLong)len, 
+                           level);
+    if (status != Z_OK) {
+      batch->failed = true;
+    } else if (dlen < len) {
+      batch->ccodec[idx] = FRAME_CODEC_DEFLATE;
+      batch->clen[idx]   = (size_t)dlen;
+    }
+  } else if (fw->codec == FRAME_CODEC_LZ4) {
+    // Output which would not be smaller is abandoned early
+    size_t clen = lz4_compress_ptr_ptr(src, len, batch->cbuf + idx * fw->ccapacity, len - 1);
+    if (clen > 0) {
+      batch->ccodec[idx] = FRAME_CODEC_LZ4;
+      batch->clen[idx]   = clen;
+    }
+  }
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Note the offsets of a block as it is emitted
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void record_block(frame_writer_t *fw, size_t ulen, size_t clen) {
+  if (fw->nemitted == fw->capacity_emitted) {
+    size_t new_capacity = fw->capacity_emitted == 0 ? 64 : fw->capacity_emitted * 2;
+    uint64_t *uoffset = realloc(fw->uoffset, new_capacity * sizeof(uint64_t));
+    if (uoffset == NULL) Rf_error("frame_write(): realloc failed");
+    fw->uoffset = uoffset;
+    uint64_t *coffset = realloc(fw->coffset, new_capacity * sizeof(uint64_t));
+    if (coffset == NULL) Rf_error("frame_write(): realloc failed");
+    fw->coffset = coffset;
+    fw->capacity_emitted = new_capacity;
+  }
+
+  fw->uoffset[fw->nemitted] = fw->utotal;
+  fw->coffset[fw->nemitted] = fw->ctotal;
+  fw->nemitted++;
+  fw->utotal += ulen;
+  fw->ctotal += clen;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Wait for the batch with the workers (if any), then emit its blocks 
+// in order.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void drain_batch(frame_writer_t *fw) {
+  if (!fw->busy) return;
+
+  pool_wait(fw->pool);
+  fw->busy = false;
+
+  frame_wbatch_t *batch = &fw->batch[1 - fw->cur];
+  if (batch->failed) {
+    Rf_error("frame_write(): Compression failed");
+  }
+
+  size_t nblocks = (batch->len + fw->block_size - 1) / fw->block_size;
+  for (size_t i = 0; i < nblocks; i++) {
+    size_t ulen = batch->len - i * fw->block_size;
+    if (ulen > fw->block_size) ulen = fw->block_size;
+
+    uint8_t *payload = batch->ccodec[i] == FRAME_CODEC_NONE ?
+      batch->block + i * fw->block_size :
+      batch->cbuf  + i * fw->ccapacity;
+
+    uint8_t hdr[FRAME_HEADER_LEN];
+    hdr[0] = (uint8_t)batch->ccodec[i];
+    put_u32le(hdr + 1, (uint32_t)ulen);
+    put_u32le(hdr + 5, (uint32_t)batch->clen[i]);
+
+    fw->write(fw->user_data, hdr, FRAME_HEADER_LEN);
+    fw->write(fw->user_data, payload, batch->clen[i]);
+    record_block(fw, ulen, FRAME_HEADER_LEN + batch->clen[i]);
+  }
+
+  batch->len = 0;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Hand the current batch to the workers and start filling the other one.
+// The other batch is emitted first if it is still with the workers.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void submit_batch(frame_writer_t *fw) {
+  drain_batch(fw);
+
+  frame_wbatch_t *batch = &fw->batch[fw->cur];
+  size_t nblocks = (batch->len + fw->block_size - 1) / fw->block_size;
+  batch->failed = false;
+
+  fw->cur  = 1 - fw->cur;
+  fw->busy = true;
+  pool_submit(fw->pool, nblocks, compress_task, fw);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Callback for the serialization context.
+// Gather bytes into the current batch of blocks. Full batches are 
+// compressed in the background. 
+//
+// Data is always copied, as the caller is free to reuse its memory as 
+// soon as this returns.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void frame_write(void *user_data, void *buf, size_t len) {
+  frame_writer_t *fw = (frame_writer_t *)user_data;
+  uint8_t *src = (uint8_t *)buf;
+  size_t batch_size = fw->nslots * fw->block_size;
+
+  while (len > 0) {
+    frame_wbatch_t *batch = &fw->batch[fw->cur];
+
+    size_t n = batch_size - batch->len;
+    if (n > len) n = len;
+    memcpy(batch->block + batch->len, src, n);
+    batch->len += n;
+    src += n;
+    len -= n;
+
+    if (batch->len == batch_size) {
+      submit_batch(fw);
+    }
+  }
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Emit any outstanding batches and the end-of-stream marker.
+// Must be called after 'ctx_flush()'
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void frame_writer_finish(frame_writer_t *fw) {
+  if (fw->batch[fw->cur].len > 0) {
+    submit_batch(fw);
+  }
+  drain_batch(fw);
+
+  uint8_t hdr[FRAME_HEADER_LEN] = {0};
+  fw->write(fw->user_data, hdr, FRAME_HEADER_LEN);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Stop the workers and free the writer. 
+// Called directly, or by the guard's finalizer after an R error.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void frame_writer_destroy(frame_writer_t *fw) {
+  if (fw == NULL) return;
+  if (fw->guard_ != NULL) {
+    R_ClearExternalPtr(fw->guard_);
+  }
+  pool_destroy(fw->pool);
+  for (int i = 0; i < 2; i++) {
+    free(fw->batch[i].block);
+    free(fw->batch[i].cbuf);
+    free(fw->batch[i].clen);
+    free(fw->batch[i].ccodec);
+  }
+  free(fw->uoffset);
+  free(fw->coffset);
+  free(fw);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+//  Frame Reader
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+static void frame_reader_finalizer(SEXP guard_) {
+  frame_reader_destroy((frame_reader_t *)R_ExternalPtrAddr(guard_));
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Create a frame reader which pulls compressed blocks from 'read()'
+// The caller must PROTECT 'fr->guard_'
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+frame_reader_t *frame_reader_create(void *user_data,
+                                    void (*read)(void *user_data, void *buf, size_t len),
+                                    opts_t *opts) {
+  frame_reader_t *fr = calloc(1, sizeof(frame_reader_t));
+  if (fr == NULL) Rf_error("frame_reader_create(): malloc failed");
+
+  fr->user_data = user_data;
+  fr->read      = read;
+  fr->nslots    = opts->nthreads > 1 ? (size_t)opts->nthreads * FRAME_BATCH : 1;
+
+  bool ok = true;
+  for (int i = 0; i < 2; i++) {
+    frame_rbatch_t *batch = &fr->batch[i];
+    batch->codec = calloc(fr->nslots, sizeof(int));
+    batch->ulen  = calloc(fr->nslots, sizeof(size_t));
+    batch->clen  = calloc(fr->nslots, sizeof(size_t));
+    batch->uoff  = calloc(fr->nslots, sizeof(size_t));
+    batch->coff  = calloc(fr->nslots, sizeof(size_t));
+    if (batch->codec == NULL || batch->ulen == NULL || batch->clen == NULL || 
+        batch->uoff == NULL || batch->coff == NULL) {
+      ok = false;
+    }
+  }
+  if (!ok) {
+    frame_reader_destroy(fr);
+    Rf_error("frame_reader_create(): malloc failed");
+  }
+
+  fr->guard_ = PROTECT(R_MakeExternalPtr(fr, R_NilValue, R_NilValue));
+  R_RegisterCFinalizerEx(fr->guard_, frame_reader_finalizer, TRUE);
+  UNPROTECT(1);
+
+  // One worker per thread.  The main thread keeps unserializing
+  fr->pool = pool_create(opts->nthreads + 1);
+
+  return fr;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Grow a buffer to at least 'len' bytes. Contents are preserved.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void reserve(uint8_t **buf, size_t *capacity, size_t len) {
+  if (len <= *capacity) return;
+  uint8_t *tmp = realloc(*buf, len);
+  if (tmp == NULL) Rf_error("frame_read(): realloc failed");
+  *buf = tmp;
+  *capacity = len;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Decompress a single block of the batch with the workers.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void decompress_task(void *arg, size_t idx) {
+  frame_reader_t *fr = (frame_reader_t *)arg;
+  frame_rbatch_t *batch = &fr->batch[1 - fr->cur];
+
+  if (batch->codec[idx] == FRAME_CODEC_NONE) return; // Already read in-place
+  if (!decode_block(batch->codec[idx], batch->cbuf + batch->coff[idx], batch->clen[idx],
+                    batch->block + batch->uoff[idx], batch->ulen[idx])) {
+    batch->failed = true;
+  }
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Read the batch after the current one from the source and hand it to
+// the workers to decompress.  Stored blocks are read straight into place.
+// Nothing is started once the end-of-stream block has been seen.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void prefetch_batch(frame_reader_t *fr) {
+  frame_rbatch_t *batch = &fr->batch[1 - fr->cur];
+
+  size_t utotal = 0;
+  size_t ctotal = 0;
+  batch->nblocks = 0;
+
+  while (!fr->eof && batch->nblocks < fr->nslots) {
+    uint8_t hdr[FRAME_HEADER_LEN];
+    fr->read(fr->user_data, hdr, FRAME_HEADER_LEN);
+
+    size_t i = batch->nblocks;
+    parse_frame_header(hdr, &batch->codec[i], &batch->ulen[i], &batch->clen[i]);
+    if (batch->ulen[i] == 0) {
+      fr->eof = true;
+      break;
+    }
+
+    batch->uoff[i] = utotal;
+    batch->coff[i] = ctotal;
+    reserve(&batch->block, &batch->capacity, utotal + batch->ulen[i]);
+
+    if (batch->codec[i] == FRAME_CODEC_NONE) {
+      fr->read(fr->user_data, batch->block + utotal, batch->ulen[i]);
+    } else {
+      reserve(&batch->cbuf, &batch->ccapacity, ctotal + batch->clen[i]);
+      fr->read(fr->user_data, batch->cbuf + ctotal, batch->clen[i]);
+      ctotal += batch->clen[i];
+    }
+    utotal += batch->ulen[i];
+    batch->nblocks++;
+  }
+
+  if (batch->nblocks == 0) return;
+
+  batch->pos    = 0;
+  batch->len    = utotal;
+  batch->failed = false;
+  fr->busy = true;
+  pool_submit(fr->pool, batch->nblocks, decompress_task, fr);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Make the batch with the workers the current batch once it has been 
+// decompressed, and start on the one after it.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void next_batch(frame_reader_t *fr) {
+  if (!fr->started) {
+    fr->started = true;
+    prefetch_batch(fr);
+  }
+
+  if (!fr->busy) {
+    Rf_error("frame_read(): Unexpected end of data");
+  }
+
+  pool_wait(fr->pool);
+  fr->busy = false;
+  fr->cur  = 1 - fr->cur;
+
+  if (fr->batch[fr->cur].failed) {
+    Rf_error("frame_read(): Decompression failed");
+  }
+
+  prefetch_batch(fr);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Callback for the unserialization context
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void frame_read(void *user_data, void *buf, size_t len) {
+  frame_reader_t *fr = (frame_reader_t *)user_data;
+  uint8_t *dst = (uint8_t *)buf;
+
+  while (len > 0) {
+    frame_rbatch_t *batch = &fr->batch[fr->cur];
+    if (batch->pos == batch->len) {
+      next_batch(fr);
+      continue;
+    }
+    size_t n = batch->len - batch->pos;
+    if (n > len) n = len;
+    memcpy(dst, batch->block + batch->pos, n);
+    batch->pos += n;
+    dst += n;
+    len -= n;
+  }
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Stop the workers and free the reader. 
+// Called directly, or by the guard's finalizer after an R error.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void frame_reader_destroy(frame_reader_t *fr) {
+  if (fr == NULL) return;
+  if (fr->guard_ != NULL) {
+    R_ClearExternalPtr(fr->guard_);
+  }
+  pool_destroy(fr->pool);
+  for (int i = 0; i < 2; i++) {
+    free(fr->batch[i].block);
+    free(fr->batch[i].cbuf);
+    free(fr->batch[i].codec);
+    free(fr->batch[i].ulen);
+    free(fr->batch[i].clen);
+    free(fr->batch[i].uoff);
+    free(fr->batch[i].coff);
+  }
+  free(fr);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// State for decompressing an in-memory stream on the pool
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+typedef struct {
+  uint8_t *src;
+  uint8_t *dst;
+  size_t *coff;   // offset of each block's header in 'src'
+  size_t *uoff;   // offset of each block's data in 'dst'
+  bool failed;
+} unpack_t;
+
+static void unpack_task(void *arg, size_t idx) {
+  unpack_t *up = (unpack_t *)arg;
+  uint8_t *hdr = up->src + up->coff[idx];
+  int codec = hdr[0];
+  size_t ulen = get_u32le(hdr + 1);
+  size_t clen = get_u32le(hdr + 5);
+  if (!decode_block(codec, hdr + FRAME_HEADER_LEN, clen, up->dst + up->uoff[idx], ulen)) {
+    up->failed = true;
+  }
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Decompress all blocks of an in-memory framed stream into a single
+// malloc'd buffer.
+//
+// The block headers are scanned first to find the total size so the
+// output is allocated exactly once. Blocks are then decompressed in 
+// parallel.  The caller must free the result.
+//
+// @param src pointer to the first block header
+// @param src_len number of bytes available at 'src'
+// @param len [out] total uncompressed length
+// @param nthreads number of threads
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+uint8_t *frame_unpack(uint8_t *src, size_t src_len, size_t *len, int nthreads) {
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Pass 1: validate block headers and total the uncompressed size
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  size_t total = 0;
+  size_t nblocks = 0;
+  size_t pos = 0;
+  while (true) {
+    if (pos + FRAME_HEADER_LEN > src_len) {
+      Rf_error("frame_unpack(): Unexpected end of data");
+    }
+    int codec;
+    size_t ulen, clen;
+    parse_frame_header(src + pos, &codec, &ulen, &clen);
+    pos += FRAME_HEADER_LEN;
+    if (ulen == 0) break;
+    if (clen > src_len - pos) {
+      Rf_error("frame_unpack(): Unexpected end of data");
+    }
+    pos += clen;
+    total += ulen;
+    nblocks++;
+  }
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Pass 2: record the offsets of every block
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  unpack_t up = {0};
+  up.src  = src;
+  up.dst  = malloc(total > 0 ? total : 1);
+  up.coff = malloc((nblocks + 1) * sizeof(size_t));
+  up.uoff = malloc((nblocks + 1) * sizeof(size_t));
+  if (up.dst == NULL || up.coff == NULL || up.uoff == NULL) {
+    free(up.dst); free(up.coff); free(up.uoff);
+    Rf_error("frame_unpack(): malloc failed");
+  }
+
+  size_t upos = 0;
+  pos = 0;
+  for (size_t i = 0; i < nblocks; i++) {
+    up.coff[i] = pos;
+    up.uoff[i] = upos;
+    upos += get_u32le(src + pos + 1);
+    pos  += FRAME_HEADER_LEN + get_u32le(src + pos + 5);
+  }
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Pass 3: decompress
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  pool_t *pool = nthreads > 1 && nblocks > 1 ? pool_create(nthreads) : NULL;
+  pool_run(pool, nblocks, unpack_task, &up);
+  pool_destroy(pool);
+
+  free(up.coff);
+  free(up.uoff);
+  if (up.failed) {
+    free(up.dst);
+    Rf_error("frame_unpack(): Decompression failed");
+  }
+
+  *len = total;
+  return up.dst;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Decompress the next block of a framed stream which is arriving in pieces.
+// See 'zap-push.c'
+//
+// The block is appended to a malloc'd output buffer which is grown as 
+// needed.
+//
+// @param src pointer to the next block header
+// @param src_len number of bytes available at 'src'
+// @param dst,dst_len,dst_capacity output buffer, its length and capacity
+// @param end [out] set to true if this was the end-of-stream block
+// @return number of bytes of 'src' used.  0 if the whole block has not 
+//         arrived yet.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+size_t frame_unpack_next(uint8_t *src, size_t src_len, uint8_t **dst, size_t *dst_len,
+                         size_t *dst_capacity, bool *end) {
+  *end = false;
+  if (src_len < FRAME_HEADER_LEN) return 0;
+
+  int codec;
+  size_t ulen, clen;
+  parse_frame_header(src, &codec, &ulen, &clen);
+  if (ulen == 0) {
+    *end = true;
+    return FRAME_HEADER_LEN;
+  }
+  if (clen > src_len - FRAME_HEADER_LEN) return 0;
+
+  // Grow geometrically so a long stream of blocks is not copied repeatedly
+  size_t want = *dst_len + ulen;
+  if (want > *dst_capacity) {
+    reserve(dst, dst_capacity, want > 2 * *dst_capacity ? want : 2 * *dst_capacity);
+  }
+
+  if (!decode_block(codec, src + FRAME_HEADER_LEN, clen, *dst + *dst_len, ulen)) {
+    Rf_error("frame_unpack_next(): Decompression failed");
+  }
+  *dst_len += ulen;
+  return FRAME_HEADER_LEN + clen;
+}
@@ -0,0 +1,176 @@
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Framed container
+//
+// When the header has 'FLAG2_FRAMED' set, the zap stream following the
+// 4-byte header is cut into blocks of 'block_size' bytes and each block
+// is compressed independently.
+//
+// Each block:
+//   [0]    codec (uint8_t)  FRAME_CODEC_NONE, FRAME_CODEC_DEFLATE, 
+//                           FRAME_CODEC_LZ4
+//   [1-4]  uncompressed length (uint32_t, little endian)
+//   [5-8]  compressed length   (uint32_t, little endian)
+//   [9-]   compressed data
+//
+// The final block has an uncompressed length of zero.
+//
+// If a block does not compress, it is stored with FRAME_CODEC_NONE.
+//
+// Each block names its own codec, so a reader never has to guess the 
+// compression.  The level is only needed when compressing so is not stored.
+//   - FRAME_CODEC_DEFLATE  zlib stream. Levels 1 (fastest) to 9 (smallest)
+//   - FRAME_CODEC_LZ4      LZ4 block. See 'utils-lz4.c'. Much faster to 
+//                          compress and decompress than deflate, but larger
+//
+// The frame writer/reader sit between the serialization context and the
+// underlying sink/source.  'frame_write()' and 'frame_read()' have the
+// same signatures as the context callbacks.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#include "utils-pool.h"
+
+#define FLAG2_FRAMED 0x01
+
+#define FRAME_HEADER_LEN 9
+
+#define FRAME_CODEC_NONE    0
+#define FRAME_CODEC_DEFLATE 1
+#define FRAME_CODEC_LZ4     2
+
+#define FRAME_LEVEL_DEFAULT -1  // Default level for the codec
+
+#define FRAME_BLOCK_SIZE_DEFAULT (1024 * 1024)
+#define FRAME_BLOCK_SIZE_MIN     (4 * 1024)
+#define FRAME_BLOCK_SIZE_MAX     (64 * 1024 * 1024)
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Multi-threading
+//
+// With 'threads = n', blocks are handled in batches of 'n * FRAME_BATCH' 
+// blocks (a single block with 1 thread).  All blocks in a batch are 
+// compressed (or decompressed) in parallel on a pool of 'n' workers.
+//
+// Compression is pipelined with serialization.  There are two batches: 
+// while the workers compress one, the main thread carries on transforming 
+// the object into the other.  When a batch fills, the previous batch is 
+// waited for and emitted in order, then the full batch is handed to the 
+// workers.  So even with 1 thread, a write takes about as long as the 
+// slower of the two stages rather than their sum.
+//
+// Reading is the mirror image: while the main thread decodes the current 
+// batch, the next batch is read from the source and decompressed by the 
+// workers.
+//
+// All reads/writes of the underlying source/sink are on the main thread.
+//
+// The writer/reader owns running threads, so it is tied to 'guard_' - an
+// external pointer whose finalizer destroys it.  The caller must PROTECT 
+// 'guard_' so that if an R error is raised before the normal 'destroy()'
+// the threads are still stopped once the guard is garbage collected.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#define FRAME_BATCH 2
+
+typedef struct {
+  // Uncompressed data
+  uint8_t *block;
+  size_t len;
+
+  // Compressed output for each block. Each slot has 'ccapacity' bytes
+  uint8_t *cbuf;
+  size_t *clen;
+  int *ccodec;
+  bool failed;
+} frame_wbatch_t;
+
+
+typedef struct {
+  // The underlying sink
+  void *user_data;
+  void (*write)(void *user_data, void *buf, size_t len);
+
+  int codec;
+  int level;
+  size_t block_size;
+  size_t nslots;
+  size_t ccapacity;
+
+  // 'batch[cur]' is being filled. The other batch may be with the workers
+  frame_wbatch_t batch[2];
+  int cur;
+  bool busy;
+
+  // Uncompressed and compressed offset of each block emitted so far.
+  // Used by the index. See 'io-index.h'
+  uint64_t *uoffset;
+  uint64_t *coffset;
+  size_t nemitted;
+  size_t capacity_emitted;
+  uint64_t utotal;
+  uint64_t ctotal;
+
+  pool_t *pool;
+  SEXP guard_;
+} frame_writer_t;
+
+
+typedef struct {
+  // Uncompressed data. Bytes in [pos, len) not yet read
+  uint8_t *block;
+  size_t pos;
+  size_t len;
+  size_t capacity;
+
+  // Compressed input
+  uint8_t *cbuf;
+  size_t ccapacity;
+
+  // Per-block details
+  size_t nblocks;
+  int *codec;
+  size_t *ulen;
+  size_t *clen;
+  size_t *uoff;
+  size_t *coff;
+  bool failed;
+} frame_rbatch_t;
+
+
+typedef struct {
+  // The underlying source
+  void *user_data;
+  void (*read)(void *user_data, void *buf, size_t len);
+
+  size_t nslots;
+
+  // 'batch[cur]' is being read. The other batch may be with the workers
+  frame_rbatch_t batch[2];
+  int cur;
+  bool busy;
+  bool started;
+
+  // Has the end-of-stream block been seen?
+  bool eof;
+
+  pool_t *pool;
+  SEXP guard_;
+} frame_reader_t;
+
+
+frame_writer_t *frame_writer_create(void *user_data,
+                                    void (*write)(void *user_data, void *buf, size_t len),
+                                    opts_t *opts);
+void frame_write(void *user_data, void *buf, size_t len);
+void frame_writer_finish(frame_writer_t *fw);
+void frame_writer_destroy(frame_writer_t *fw);
+
+frame_reader_t *frame_reader_create(void *user_data,
+                                    void (*read)(void *user_data, void *buf, size_t len),
+                                    opts_t *opts);
+void frame_read(void *user_data, void *buf, size_t len);
+void frame_reader_destroy(frame_reader_t *fr);
+
+uint8_t *frame_unpack(uint8_t *src, size_t src_len, size_t *len, int nthreads);
+size_t frame_unpack_next(uint8_t *src, size_t src_len, uint8_t **dst, size_t *dst_len,
+                         size_t *dst_capacity, bool *end);
@@ -0,0 +1,419 @@
+#define R_NO_REMAP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <R.h>
+#include <Rinternals.h>
+#include <Rdefines.h>
+
+#include "io-ctx.h"
+#include "io-core.h"
+#include "io-frame.h"
+#include "io-plan.h"
+#include "io-index.h"
+
+#include "utils-df.h"
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Create an empty index
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+index_t *index_create(void) {
+  index_t *index = calloc(1, sizeof(index_t));
+  if (index == NULL) Rf_error("index_create(): malloc failed");
+
+  index->capacity = 64;
+  index->entries  = calloc(index->capacity, sizeof(index_entry_t));
+  if (index->entries == NULL) {
+    free(index);
+    Rf_error("index_create(): malloc failed");
+  }
+
+  index->obj_        = NULL;
+  index->obj_entry   = -1;
+  index->min_env_ref = INT64_MAX;
+  index->min_vec_ref = INT64_MAX;
+
+  return index;
+}
+
+
+void index_destroy(index_t *index) {
+  if (index == NULL) return;
+  free(index->entries);
+  free(index);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Each entry has two marks: 2 * entry for its start, and 2 * entry + 1
+// for its end
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void index_set_position(index_t *index, size_t mark, uint64_t pos) {
+  index_entry_t *entry = &index->entries[mark / 2];
+  if (mark % 2 == 0) {
+    entry->start = pos;
+  } else {
+    entry->end = pos;
+  }
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Record the current stream position for a mark.
+// With a plan, the position is only known once the plan has run, so the
+// staged bytes must reach it first.  Otherwise the position includes the 
+// staged bytes and nothing is flushed
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void index_mark(ctx_t *ctx, size_t mark) {
+  if (ctx->plan != NULL) {
+    ctx_flush(ctx);
+    plan_mark(ctx->plan, mark);
+  } else {
+    size_t pos = ctx->nwritten + (size_t)(ctx->wptr - ctx->stage);
+    index_set_position(ctx->index, mark, (uint64_t)pos);
+  }
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Start an entry for an object which is about to be written
+//
+// @param parent entry of the enclosing list. -1 for the object itself
+// @param name_ CHARSXP name within the parent. NA_STRING if none
+// @param x_ the object. NULL for attributes
+// @return the new entry
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+int64_t index_begin(ctx_t *ctx, int64_t parent, SEXP name_, SEXP x_) {
+  index_t *index = ctx->index;
+
+  if (index->nentries == index->capacity) {
+    size_t new_capacity = index->capacity * 2;
+    index_entry_t *new_entries = realloc(index->entries, new_capacity * sizeof(index_entry_t));
+    if (new_entries == NULL) Rf_error("index_begin(): realloc failed");
+    index->entries  = new_entries;
+    index->capacity = new_capacity;
+  }
+
+  int64_t k = (int64_t)index->nentries++;
+  index_entry_t *entry = &index->entries[k];
+  memset(entry, 0, sizeof(index_entry_t));
+  entry->parent        = parent;
+  entry->name_         = name_;
+  entry->attrs         = false;
+  entry->attrs_entry   = -1;
+  entry->env_base      = ctx->Nenv;
+  entry->vec_base      = ctx->Nvecsxp;
+  entry->outer_env_ref = index->min_env_ref;
+  entry->outer_vec_ref = index->min_vec_ref;
+
+  if (x_ != NULL) {
+    entry->type = TYPEOF(x_);
+    switch(entry->type) {
+    case LGLSXP:
+    case INTSXP:
+    case REALSXP:
+    case STRSXP:
+    case RAWSXP:
+      entry->length = Rf_xlength(x_);
+      entry->plain  = ATTRIB(x_) == R_NilValue;
+      break;
+    case VECSXP:
+      entry->length = Rf_xlength(x_);
+      break;
+    default:
+      break;
+    }
+  }
+
+  index->min_env_ref = INT64_MAX;
+  index->min_vec_ref = INT64_MAX;
+  index->obj_        = x_;
+  index->obj_entry   = k;
+
+  index_mark(ctx, 2 * (size_t)k);
+  return k;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Finish a single entry. References made within it also count against
+// the enclosing entry
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void index_close(ctx_t *ctx, int64_t k) {
+  index_t *index = ctx->index;
+  index_entry_t *entry = &index->entries[k];
+
+  entry->standalone =
+    index->min_env_ref >= (int64_t)entry->env_base &&
+    index->min_vec_ref >= (int64_t)entry->vec_base;
+
+  if (entry->outer_env_ref < index->min_env_ref) index->min_env_ref = entry->outer_env_ref;
+  if (entry->outer_vec_ref < index->min_vec_ref) index->min_vec_ref = entry->outer_vec_ref;
+
+  // An object which was not written as a list can't claim a later one
+  if (index->obj_entry == k) index->obj_ = NULL;
+
+  index_mark(ctx, 2 * (size_t)k + 1);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Finish an entry once its object (including attributes) has been written
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void index_end(ctx_t *ctx, int64_t k) {
+  int64_t attrs_entry = ctx->index->entries[k].attrs_entry;
+  if (attrs_entry >= 0) {
+    index_close(ctx, attrs_entry);
+  }
+  index_close(ctx, k);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Is this list the object of the most recent entry?
+// Only lists with an entry have their elements indexed
+//
+// @return the entry, or -1
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+int64_t index_owner(ctx_t *ctx, SEXP x_) {
+  index_t *index = ctx->index;
+  if (index == NULL || index->obj_ != x_) return -1;
+
+  index->obj_ = NULL;
+  return index->obj_entry;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Start an entry for the attributes of a list once its elements have
+// been written.  It is finished along with the list in 'index_end()'
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void index_begin_attrs(ctx_t *ctx, int64_t owner) {
+  int64_t k = index_begin(ctx, owner, NA_STRING, NULL);
+  ctx->index->entries[k].attrs           = true;
+  ctx->index->entries[owner].attrs_entry = k;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Start an entry for a chunk of a vector which is about to be written.
+// See 'io-chunk.h'
+//
+// @param owner entry of the vector from 'index_owner()'. If -1 the vector 
+//        has no entry and nothing is recorded
+// @param len number of elements in the chunk
+// @return the new entry, or -1
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+int64_t index_begin_chunk(ctx_t *ctx, int64_t owner, size_t len) {
+  if (owner < 0) return -1;
+
+  int64_t k = index_begin(ctx, owner, NA_STRING, NULL);
+  index_entry_t *entry = &ctx->index->entries[k];
+  entry->chunk  = true;
+  entry->type   = ctx->index->entries[owner].type;
+  entry->length = (R_xlen_t)len;
+  return k;
+}
+
+
+void index_end_chunk(ctx_t *ctx, int64_t k) {
+  if (k < 0) return;
+  index_close(ctx, k);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Note a reference to an earlier environment or list
+//
+// @param cache ZAP_CACHE_ENVSXP or ZAP_CACHE_VECSXP
+// @param idx position in the cache
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void index_ref(ctx_t *ctx, int cache, R_xlen_t idx) {
+  index_t *index = ctx->index;
+  if (index == NULL) return;
+
+  if (cache == ZAP_CACHE_ENVSXP) {
+    if ((int64_t)idx < index->min_env_ref) index->min_env_ref = (int64_t)idx;
+  } else {
+    if ((int64_t)idx < index->min_vec_ref) index->min_vec_ref = (int64_t)idx;
+  }
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Callback which counts the bytes passed through to the sink
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+typedef struct {
+  void *user_data;
+  void (*write)(void *user_data, void *buf, size_t len);
+  uint64_t len;
+} count_sink_t;
+
+static void count_write(void *user_data, void *buf, size_t len) {
+  count_sink_t *sink = (count_sink_t *)user_data;
+  sink->write(sink->user_data, buf, len);
+  sink->len += len;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Block offsets of a framed stream.
+// There is one extra value for the position of the end-of-stream block
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static SEXP block_offsets(uint64_t *offset, size_t n, uint64_t total) {
+  SEXP res_ = PROTECT(Rf_allocVector(REALSXP, (R_xlen_t)n + 1));
+  double *res = REAL(res_);
+  for (size_t i = 0; i < n; i++) {
+    res[i] = (double)offset[i];
+  }
+  res[n] = (double)total;
+  UNPROTECT(1);
+  return res_;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Write the index and trailer to the sink.
+//
+// The index is a named list of equal length vectors (one value per
+// entry), serialized with default options:
+//   parent      row of the enclosing list (1-based). 0 for the object
+//   name        name within the enclosing list
+//   attrs       is this entry the attributes of 'parent'?
+//   chunk       is this entry a chunk of 'parent'?
+//   start, end  position in the stream
+//   env_base, vec_base  cache sizes at 'start'
+//   standalone  can this entry be read on its own?
+//   type, length  of the object (or chunk). NA for attributes
+//   plain       is this an atomic vector without attributes?
+// and, for a framed stream, 'ustart' and 'cstart': the uncompressed and
+// compressed offset of each block.
+//
+// Must be called after 'frame_writer_finish()'
+//
+// @param fw frame writer. NULL if the stream is not framed
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void write_index(index_t *index, frame_writer_t *fw,
+                 void *user_data, void (*write)(void *user_data, void *buf, size_t len)) {
+
+  R_xlen_t n = (R_xlen_t)index->nentries;
+  if (index->nentries > INT32_MAX) {
+    Rf_error("write_index(): Too many entries: %.0f", (double)index->nentries);
+  }
+
+  SEXP parent_     = PROTECT(Rf_allocVector(INTSXP , n));
+  SEXP name_       = PROTECT(Rf_allocVector(STRSXP , n));
+  SEXP attrs_      = PROTECT(Rf_allocVector(LGLSXP , n));
+  SEXP chunk_      = PROTECT(Rf_allocVector(LGLSXP , n));
+  SEXP start_      = PROTECT(Rf_allocVector(REALSXP, n));
+  SEXP end_        = PROTECT(Rf_allocVector(REALSXP, n));
+  SEXP env_base_   = PROTECT(Rf_allocVector(REALSXP, n));
+  SEXP vec_base_   = PROTECT(Rf_allocVector(REALSXP, n));
+  SEXP standalone_ = PROTECT(Rf_allocVector(LGLSXP , n));
+  SEXP type_       = PROTECT(Rf_allocVector(INTSXP , n));
+  SEXP length_     = PROTECT(Rf_allocVector(REALSXP, n));
+  SEXP plain_      = PROTECT(Rf_allocVector(LGLSXP , n));
+
+  for (R_xlen_t i = 0; i < n; i++) {
+    index_entry_t *entry = &index->entries[i];
+    INTEGER(parent_)[i]   = (int)(entry->parent + 1);
+    SET_STRING_ELT(name_, i, entry->name_);
+    LOGICAL(attrs_)[i]    = entry->attrs;
+    LOGICAL(chunk_)[i]    = entry->chunk;
+    REAL(start_)[i]       = (double)entry->start;
+    REAL(end_)[i]         = (double)entry->end;
+    REAL(env_base_)[i]    = (double)entry->env_base;
+    REAL(vec_base_)[i]    = (double)entry->vec_base;
+    LOGICAL(standalone_)[i] = entry->standalone;
+    INTEGER(type_)[i]     = entry->attrs ? NA_INTEGER : (int)entry->type;
+    REAL(length_)[i]      = entry->attrs ? NA_REAL    : (double)entry->length;
+    LOGICAL(plain_)[i]    = entry->plain;
+  }
+
+  SEXP ustart_ = R_NilValue;
+  SEXP cstart_ = R_NilValue;
+  if (fw != NULL) {
+    ustart_ = block_offsets(fw->uoffset, fw->nemitted, fw->utotal);
+    PROTECT(ustart_);
+    cstart_ = block_offsets(fw->coffset, fw->nemitted, fw->ctotal);
+    PROTECT(cstart_);
+  } else {
+    PROTECT(ustart_);
+    PROTECT(cstart_);
+  }
+
+  SEXP index_ = PROTECT(create_named_list(
+    14,
+    "parent"    , parent_,
+    "name"      , name_,
+    "attrs"     , attrs_,
+    "chunk"     , chunk_,
+    "start"     , start_,
+    "end"       , end_,
+    "env_base"  , env_base_,
+    "vec_base"  , vec_base_,
+    "standalone", standalone_,
+    "type"      , type_,
+    "length"    , length_,
+    "plain"     , plain_,
+    "ustart"    , ustart_,
+    "cstart"    , cstart_
+  ));
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // The index is a zap stream of its own
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  count_sink_t sink = { .user_data = user_data, .write = write, .len = 0 };
+
+  uint8_t header[4] = { 'Z' | 0x80, ZAP_VERSION, 0x00, 0x00 };
+  count_write(&sink, header, sizeof(header));
+
+  opts_t *opts = parse_options(R_NilValue);
+  ctx_t *ctx = create_serialize_ctx(&sink, count_write, opts);
+  write_sexp(ctx, index_);
+  ctx_flush(ctx);
+  ctx_destroy(ctx);
+  free(opts);
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Trailer
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  uint8_t trailer[INDEX_TRAILER_LEN];
+  for (int i = 0; i < 8; i++) {
+    trailer[i] = (uint8_t)(sink.len >> (8 * i));
+  }
+  memcpy(trailer + 8, INDEX_MAGIC, 4);
+  write(user_data, trailer, INDEX_TRAILER_LEN);
+
+  UNPROTECT(15);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Prepare an unserialization context to read a single entry, so that
+// environments and lists are numbered in the cache as they were written
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void index_prepare_read(ctx_t *ctx, R_xlen_t env_base, R_xlen_t vec_base) {
+
+  SEXP env_list_ = VECTOR_ELT(ctx->cache, ZAP_CACHE_ENVSXP);
+  if (env_base >= Rf_xlength(env_list_)) {
+    SEXP expanded_ = PROTECT(Rf_xlengthgets(env_list_, 2 * env_base + 4));
+    SET_VECTOR_ELT(ctx->cache, ZAP_CACHE_ENVSXP, expanded_);
+    UNPROTECT(1);
+  }
+  ctx->Nenv = env_base;
+
+  SEXP vecsxp_list_ = VECTOR_ELT(ctx->cache, ZAP_CACHE_VECSXP);
+  if (vec_base >= Rf_xlength(vecsxp_list_)) {
+    SEXP expanded_ = PROTECT(Rf_xlengthgets(vecsxp_list_, 2 * vec_base + 4));
+    SET_VECTOR_ELT(ctx->cache, ZAP_CACHE_VECSXP, expanded_);
+    UNPROTECT(1);
+  }
+  ctx->Nvecsxp = vec_base;
+}
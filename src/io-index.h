@@ -0,0 +1,110 @@
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Index of list elements
+//
+// With 'index = TRUE' the position of every element of every list in the
+// object is recorded as it is written, along with the list's names.  The
+// index is appended after the stream (after the end-of-stream block if
+// framed) so that a single element can be decoded without reading
+// anything before it.  The header has 'FLAG2_INDEX' set.
+//
+// Layout following the stream:
+//   [index]    a complete, unframed zap stream of the index (including
+//              its own 4-byte header).  See 'write_index()'
+//   [8 bytes]  length of [index] (uint64_t, little endian)
+//   [4 bytes]  INDEX_MAGIC
+//
+// Positions are offsets into the uncompressed stream which follows the
+// 4-byte header.  For a framed stream the index also holds the
+// uncompressed and compressed offset of each block, so only the blocks
+// holding an element need to be read and decompressed.
+//
+// An entry is recorded for:
+//   - the object itself
+//   - each element of a list which has an entry
+//   - the attributes of a list which has an entry
+// Lists found elsewhere (e.g. inside environments or attributes) are not
+// indexed.
+//
+// Environments (and lists with 'list = "reference"') are written in full
+// once and then referred to by their position in a cache.  Each entry
+// records the size of both caches where it starts so that a reader can
+// carry on the numbering from there.  An entry is 'standalone' if it
+// refers to nothing written before it.  Otherwise it can only be read
+// as part of the whole object.
+//
+// A chunked vector (see 'io-chunk.h') which has an entry also has an 
+// entry for each of its chunks, so that a range of rows of a data.frame 
+// can be read by decoding only the chunks which hold them.
+//
+// Atomic vectors without attributes are 'plain': their type and length
+// are recorded so that 'zap_read(lazy = TRUE)' can create them before
+// they are decoded (see 'utils-altrep-lazy.c').
+//
+// With a plan (see 'io-plan.h') positions are not known until the plan
+// has run, so the plan resolves them with 'index_set_position()'.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#define FLAG2_INDEX 0x02
+
+#define INDEX_MAGIC       "ZIDX"
+#define INDEX_TRAILER_LEN 12
+
+typedef struct {
+  int64_t parent;       // Entry of the enclosing list. -1 for the object
+  SEXP name_;           // CHARSXP. NA_STRING if unnamed
+  bool attrs;           // Is this entry the attributes of 'parent'?
+  int64_t attrs_entry;  // Entry for this list's attributes. -1 if none
+  bool chunk;           // Is this entry a chunk of 'parent'?
+
+  // Type and length of the object. 'plain' if it is an atomic vector 
+  // without attributes, so it can be created before it is decoded
+  SEXPTYPE type;
+  R_xlen_t length;
+  bool plain;
+
+  uint64_t start;
+  uint64_t end;
+
+  // Cache sizes at the start of this entry
+  R_xlen_t env_base;
+  R_xlen_t vec_base;
+
+  // Smallest cache references seen in the enclosing entry before this one
+  int64_t outer_env_ref;
+  int64_t outer_vec_ref;
+
+  bool standalone;
+} index_entry_t;
+
+
+typedef struct index_s {
+  index_entry_t *entries;
+  size_t nentries;
+  size_t capacity;
+
+  // The object of the most recent entry. Claimed by 'index_owner()'
+  SEXP obj_;
+  int64_t obj_entry;
+
+  // Smallest cache references since the innermost open entry began
+  int64_t min_env_ref;
+  int64_t min_vec_ref;
+} index_t;
+
+
+index_t *index_create(void);
+void index_destroy(index_t *index);
+
+int64_t index_begin(ctx_t *ctx, int64_t parent, SEXP name_, SEXP x_);
+void index_end(ctx_t *ctx, int64_t entry);
+int64_t index_owner(ctx_t *ctx, SEXP x_);
+void index_begin_attrs(ctx_t *ctx, int64_t owner);
+int64_t index_begin_chunk(ctx_t *ctx, int64_t owner, size_t len);
+void index_end_chunk(ctx_t *ctx, int64_t entry);
+void index_ref(ctx_t *ctx, int cache, R_xlen_t idx);
+void index_set_position(index_t *index, size_t mark, uint64_t pos);
+
+void write_index(index_t *index, frame_writer_t *fw,
+                 void *user_data, void (*write)(void *user_data, void *buf, size_t len));
+void index_prepare_read(ctx_t *ctx, R_xlen_t env_base, R_xlen_t vec_base);
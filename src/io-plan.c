@@ -0,0 +1,395 @@
+#define R_NO_REMAP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include <R.h>
+#include <Rinternals.h>
+#include <Rdefines.h>
+
+#include "io-ctx.h"
+#include "io-plan.h"
+#include "io-chunk.h"
+#include "io-LGLSXP.h"
+#include "io-INTSXP.h"
+#include "io-REALSXP.h"
+#include "io-frame.h"
+#include "io-index.h"
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Create a plan which emits to the given sink
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+plan_t *plan_create(void *user_data,
+                    void (*write)(void *user_data, void *buf, size_t len),
+                    opts_t *opts) {
+
+  plan_t *plan = calloc(1, sizeof(plan_t));
+  if (plan == NULL) Rf_error("plan_create(): malloc failed");
+
+  plan->user_data = user_data;
+  plan->write     = write;
+
+  plan->capacity = 128 * 1024;
+  plan->data     = malloc(plan->capacity);
+
+  plan->capacity_leaves = 64;
+  plan->leaves          = calloc(plan->capacity_leaves, sizeof(leaf_t));
+
+  plan->nthreads = opts->nthreads;
+  plan->workers  = calloc((size_t)plan->nthreads, sizeof(ctx_t *));
+
+  if (plan->data == NULL || plan->leaves == NULL || plan->workers == NULL) {
+    plan_destroy(plan);
+    Rf_error("plan_create(): malloc failed");
+  }
+
+  for (int i = 0; i < plan->nthreads; i++) {
+    plan->workers[i] = create_worker_ctx(NULL, NULL, opts);
+  }
+
+  return plan;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Callback for the main context. Append to the plan's stream buffer
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void plan_write(void *user_data, void *buf, size_t len) {
+  plan_t *plan = (plan_t *)user_data;
+
+  if (plan->len + len > plan->capacity) {
+    size_t new_capacity = plan->capacity * 2;
+    while (plan->len + len > new_capacity) {
+      new_capacity *= 2;
+    }
+    uint8_t *new_data = realloc(plan->data, new_capacity);
+    if (new_data == NULL) {
+      Rf_error("plan_write(): Couldn't grow buffer to %.0f bytes", (double)new_capacity);
+    }
+    plan->data     = new_data;
+    plan->capacity = new_capacity;
+  }
+
+  memcpy(plan->data + plan->len, buf, len);
+  plan->len += len;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Callback for the worker contexts. Append to the leaf's buffer.
+// Runs on a worker thread.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void leaf_write(void *user_data, void *buf, size_t len) {
+  leaf_t *leaf = (leaf_t *)user_data;
+
+  if (leaf->len + len > leaf->capacity) {
+    size_t new_capacity = leaf->capacity == 0 ? 64 * 1024 : leaf->capacity * 2;
+    while (leaf->len + len > new_capacity) {
+      new_capacity *= 2;
+    }
+    uint8_t *new_data = realloc(leaf->data, new_capacity);
+    if (new_data == NULL) {
+      ctx_error(leaf->ctx, "leaf_write(): Couldn't grow buffer to %.0f bytes",
+                (double)new_capacity);
+    }
+    leaf->data     = new_data;
+    leaf->capacity = new_capacity;
+  }
+
+  memcpy(leaf->data + leaf->len, buf, len);
+  leaf->len += len;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Record a leaf at the current stream position
+//
+// @param n number of elements (doubles for complex)
+// @param nbytes size of the data
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void plan_add_leaf(ctx_t *ctx, SEXPTYPE type, void *x, size_t n, size_t nbytes) {
+  plan_t *plan = ctx->plan;
+
+  if (plan->nleaves == plan->capacity_leaves) {
+    size_t new_capacity = plan->capacity_leaves * 2;
+    leaf_t *new_leaves = realloc(plan->leaves, new_capacity * sizeof(leaf_t));
+    if (new_leaves == NULL) Rf_error("plan_defer(): malloc failed");
+    plan->leaves          = new_leaves;
+    plan->capacity_leaves = new_capacity;
+  }
+
+  // Bring the stream buffer up-to-date so the offset is correct
+  ctx_flush(ctx);
+
+  leaf_t *leaf = &plan->leaves[plan->nleaves++];
+  memset(leaf, 0, sizeof(leaf_t));
+  leaf->type   = type;
+  leaf->x      = x;
+  leaf->n      = n;
+  leaf->offset = plan->len;
+
+  plan->pending_bytes += nbytes;
+  if (plan->pending_bytes >= PLAN_BATCH_BYTES) {
+    plan_run(plan);
+  }
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Should this object be encoded later on a worker thread?
+// If so, record it as a leaf (or one leaf per chunk) at the current 
+// stream position.
+//
+// @return true if the object was deferred. Its attributes must still be
+//         written by the caller.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+bool plan_defer(ctx_t *ctx, SEXP x_) {
+  plan_t *plan = ctx->plan;
+  if (plan == NULL || ALTREP(x_)) return false;
+
+  // Aligned payloads need to know their position as they are written.
+  // See 'io-align.h'
+  if (ctx->opts->align) return false;
+
+  // 'width' is the number of values per R element
+  size_t elem_size = 0;
+  size_t width     = 1;
+  switch(TYPEOF(x_)) {
+  case LGLSXP:
+    elem_size = sizeof(int32_t);
+    break;
+  case INTSXP:
+    if (Rf_isFactor(x_)) return false;
+    elem_size = sizeof(int32_t);
+    break;
+  case REALSXP:
+    elem_size = sizeof(double);
+    break;
+  case CPLXSXP:
+    elem_size = sizeof(double);
+    width     = 2;
+    break;
+  default:
+    return false;
+  }
+
+  size_t len = (size_t)Rf_xlength(x_);
+  if (len < PLAN_MIN_LEN) return false;
+
+  uint8_t *x = (uint8_t *)DATAPTR(x_);
+
+  size_t chunk_len = ctx->opts->chunk_len;
+  if (len <= chunk_len) {
+    plan_add_leaf(ctx, TYPEOF(x_), x, len * width, len * width * elem_size);
+    return true;
+  }
+
+  int64_t owner = index_owner(ctx, x_);
+  write_chunk_header(ctx, (uint8_t)TYPEOF(x_), len);
+  for (size_t start = 0; start < len; start += chunk_len) {
+    size_t n = len - start < chunk_len ? len - start : chunk_len;
+    int64_t k = index_begin_chunk(ctx, owner, n);
+    plan_add_leaf(ctx, TYPEOF(x_), x + start * width * elem_size, n * width, 
+                  n * width * elem_size);
+    index_end_chunk(ctx, k);
+  }
+
+  return true;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Record an index mark at the current position in the stream buffer.
+// The caller must have flushed the context
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void plan_mark(plan_t *plan, size_t mark) {
+
+  if (plan->nmarks == plan->capacity_marks) {
+    size_t new_capacity = plan->capacity_marks == 0 ? 64 : plan->capacity_marks * 2;
+    mark_t *new_marks = realloc(plan->marks, new_capacity * sizeof(mark_t));
+    if (new_marks == NULL) Rf_error("plan_mark(): malloc failed");
+    plan->marks          = new_marks;
+    plan->capacity_marks = new_capacity;
+  }
+
+  mark_t *m  = &plan->marks[plan->nmarks++];
+  m->mark    = mark;
+  m->offset  = plan->len;
+  m->nleaves = plan->nleaves;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Emit the stream buffer from 'pos' up to 'offset', resolving the marks
+// which were recorded in that segment after the first 'nleaves' leaves.
+//
+// @param m index of the next unresolved mark. Updated
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void emit_segment(plan_t *plan, size_t pos, size_t offset, size_t nleaves, size_t *m) {
+  while (*m < plan->nmarks && plan->marks[*m].nleaves == nleaves) {
+    mark_t *mark = &plan->marks[*m];
+    index_set_position(plan->index, mark->mark, plan->emitted + (mark->offset - pos));
+    (*m)++;
+  }
+
+  if (offset > pos) {
+    plan->write(plan->user_data, plan->data + pos, offset - pos);
+    plan->emitted += offset - pos;
+  }
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Encode a single leaf with the given worker context
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void encode_leaf(ctx_t *ctx, leaf_t *leaf) {
+  switch(leaf->type) {
+  case LGLSXP:
+    write_LGLSXP_ptr(ctx, (int32_t *)leaf->x, leaf->n);
+    break;
+  case INTSXP:
+    write_INTSXP_ptr(ctx, (int32_t *)leaf->x, leaf->n);
+    break;
+  case REALSXP:
+    write_REALSXP_ptr(ctx, (double *)leaf->x, leaf->n, false);
+    break;
+  case CPLXSXP:
+    write_REALSXP_ptr(ctx, (double *)leaf->x, leaf->n, true);
+    break;
+  default:
+    ctx_error(ctx, "encode_leaf(): unexpected type %i", leaf->type);
+  }
+  ctx_flush(ctx);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Pool task. Each task has its own worker context and claims leaves
+// until none remain.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void plan_task(void *arg, size_t idx) {
+  plan_t *plan = (plan_t *)arg;
+  ctx_t  *ctx  = plan->workers[idx];
+  jmp_buf env;
+
+  while (true) {
+    size_t i = __atomic_fetch_add(&plan->next, 1, __ATOMIC_RELAXED);
+    if (i >= plan->nleaves || __atomic_load_n(&plan->failed, __ATOMIC_RELAXED)) {
+      break;
+    }
+
+    leaf_t *leaf   = &plan->leaves[i];
+    leaf->ctx      = ctx;
+    ctx->user_data = leaf;
+    ctx->write     = leaf_write;
+    ctx->wptr      = ctx->stage;
+    ctx->err_jmp   = &env;
+
+    if (setjmp(env) == 0) {
+      encode_leaf(ctx, leaf);
+    } else {
+      leaf->failed = true;
+      memcpy(leaf->err_msg, ctx->err_msg, sizeof(leaf->err_msg));
+      __atomic_store_n(&plan->failed, true, __ATOMIC_RELAXED);
+    }
+  }
+
+  ctx->err_jmp = NULL;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Release the encoded data for all leaves and empty the plan
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void plan_reset(plan_t *plan) {
+  for (size_t i = 0; i < plan->nleaves; i++) {
+    free(plan->leaves[i].data);
+    plan->leaves[i].data = NULL;
+  }
+  plan->len           = 0;
+  plan->nleaves       = 0;
+  plan->nmarks        = 0;
+  plan->pending_bytes = 0;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Encode all pending leaves in parallel, then emit the stream in order.
+// Must be called after the final 'ctx_flush()' to emit any remaining bytes
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void plan_run(plan_t *plan) {
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Encode
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  if (plan->nleaves > 0) {
+    plan->next   = 0;
+    plan->failed = false;
+    size_t ntasks = (size_t)plan->nthreads;
+    if (ntasks > plan->nleaves) ntasks = plan->nleaves;
+    
+    // The pool only lives for this run so that no threads are left behind
+    // if an R error is raised before the plan is destroyed
+    pool_t *pool = pool_create((int)ntasks);
+    pool_run(pool, ntasks, plan_task, plan);
+    pool_destroy(pool);
+
+    if (plan->failed) {
+      char msg[sizeof(plan->leaves[0].err_msg)];
+      for (size_t i = 0; i < plan->nleaves; i++) {
+        if (plan->leaves[i].failed) {
+          memcpy(msg, plan->leaves[i].err_msg, sizeof(msg));
+          break;
+        }
+      }
+      plan_reset(plan);
+      Rf_error("%s", msg);
+    }
+  }
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Emit stream segments and leaves in order
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  size_t pos = 0;
+  size_t m   = 0;
+  for (size_t i = 0; i < plan->nleaves; i++) {
+    leaf_t *leaf = &plan->leaves[i];
+    emit_segment(plan, pos, leaf->offset, i, &m);
+    pos = leaf->offset;
+    if (leaf->len > 0) {
+      plan->write(plan->user_data, leaf->data, leaf->len);
+      plan->emitted += leaf->len;
+    }
+    free(leaf->data);
+    leaf->data = NULL;
+  }
+  emit_segment(plan, pos, plan->len, plan->nleaves, &m);
+
+  plan_reset(plan);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Free the plan. Any pending leaves are discarded
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void plan_destroy(plan_t *plan) {
+  if (plan == NULL) return;
+
+  if (plan->workers != NULL) {
+    for (int i = 0; i < plan->nthreads; i++) {
+      ctx_destroy(plan->workers[i]);
+    }
+    free(plan->workers);
+  }
+  if (plan->leaves != NULL) {
+    plan_reset(plan);
+    free(plan->leaves);
+  }
+  free(plan->marks);
+  free(plan->data);
+  free(plan);
+}
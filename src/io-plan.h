@@ -0,0 +1,105 @@
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Parallel encoding of atomic vectors
+//
+// With 'threads > 1', 'write_sexp()' does not encode large logical,
+// integer, double and complex vectors as it walks the object.  Instead
+// each vector is recorded as a "leaf" at its position in the stream, and
+// everything else is written as usual into the plan's in-memory buffer.
+//
+// 'plan_run()' then encodes all leaves in parallel - each into its own
+// buffer - and emits the stream segments and encoded leaves in order to
+// the underlying sink.  The output is identical to a single-threaded write.
+//
+// Leaves are encoded by 'write_LGLSXP_ptr()', 'write_INTSXP_ptr()' and
+// 'write_REALSXP_ptr()' using a worker context. These only read the data
+// of non-ALTREP vectors and make no R API calls.
+//
+// Vectors longer than the chunk length are written as a chunk header followed
+// by one leaf per chunk (see 'io-chunk.h'), so a single huge vector is
+// spread across all threads.  Workers claim leaves from a shared counter, 
+// so a worker which finishes early simply takes the next leaf.
+//
+// So that memory use stays bounded, the plan is run whenever the pending
+// leaves hold more than PLAN_BATCH_BYTES of data.
+//
+// Index positions (see 'io-index.h') are recorded as "marks" in the
+// plan's stream buffer and resolved to stream positions as it is emitted.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#include "utils-pool.h"
+
+#define PLAN_MIN_LEN     1024
+#define PLAN_BATCH_BYTES (64 * 1024 * 1024)
+
+typedef struct {
+  // Data to encode. A whole vector, or a single chunk of a long vector.
+  // For complex vectors 'n' is the number of doubles
+  SEXPTYPE type;
+  void *x;
+  size_t n;
+
+  // Position of this leaf in the plan's stream buffer
+  size_t offset;
+
+  // Encoded bytes
+  uint8_t *data;
+  size_t len;
+  size_t capacity;
+
+  // Worker context currently encoding this leaf
+  ctx_t *ctx;
+
+  bool failed;
+  char err_msg[256];
+} leaf_t;
+
+
+typedef struct {
+  size_t mark;     // See 'index_set_position()'
+  size_t offset;   // Position in the plan's stream buffer
+  size_t nleaves;  // Number of leaves before this mark
+} mark_t;
+
+
+typedef struct plan_s {
+  // The underlying sink
+  void *user_data;
+  void (*write)(void *user_data, void *buf, size_t len);
+
+  // The stream with all leaves removed
+  uint8_t *data;
+  size_t len;
+  size_t capacity;
+
+  // Deferred vectors
+  leaf_t *leaves;
+  size_t nleaves;
+  size_t capacity_leaves;
+  size_t pending_bytes;
+
+  // Next leaf to be claimed by a worker
+  size_t next;
+  bool failed;
+
+  // Index positions waiting to be resolved. 'emitted' counts all bytes
+  // passed to the sink so far
+  struct index_s *index;
+  mark_t *marks;
+  size_t nmarks;
+  size_t capacity_marks;
+  uint64_t emitted;
+
+  int nthreads;
+  ctx_t **workers;
+} plan_t;
+
+
+plan_t *plan_create(void *user_data,
+                    void (*write)(void *user_data, void *buf, size_t len),
+                    opts_t *opts);
+void plan_write(void *user_data, void *buf, size_t len);
+bool plan_defer(ctx_t *ctx, SEXP x_);
+void plan_mark(plan_t *plan, size_t mark);
+void plan_run(plan_t *plan);
+void plan_destroy(plan_t *plan);
@@ -0,0 +1,241 @@
+#define R_NO_REMAP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <R.h>
+#include <Rinternals.h>
+#include <Rdefines.h>
+#include <R_ext/Rdynload.h>
+#include <R_ext/Altrep.h>
+
+#include "io-ctx.h"
+#include "io-frame.h"
+#include "utils-altrep-lazy.h"
+
+// from zap-core.c
+extern SEXP read_zap_at(uint8_t *data, size_t len, SEXP at_, SEXP opts_);
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// An ALTREP vector which is decoded from a zap stream the first time its
+// data is needed.  See 'io-index.h'
+//
+// data1 = list of
+//         src    raw vector, or the path to an uncompressed file
+//         from   position of the entry's bytes in 'src'
+//         n      number of bytes
+//         at     location of the entry. See 'read_zap_at()'
+//         opts   options for reading
+//         length length of the vector
+// data2 = the decoded vector. NULL until first needed
+//
+// Only atomic vectors without attributes are created this way, so the
+// type and length are known without decoding.
+//
+// Serialization with 'serialize()'/'saveRDS()' and duplication fall back
+// to R's defaults, which decode the vector and write/copy the data.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#define LAZY_SRC    0
+#define LAZY_FROM   1
+#define LAZY_N      2
+#define LAZY_AT     3
+#define LAZY_OPTS   4
+#define LAZY_LENGTH 5
+
+static R_altrep_class_t zap_lazy_lgl_class;
+static R_altrep_class_t zap_lazy_int_class;
+static R_altrep_class_t zap_lazy_dbl_class;
+static R_altrep_class_t zap_lazy_str_class;
+static R_altrep_class_t zap_lazy_raw_class;
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Read the bytes of the entry from the file
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void read_file_bytes(const char *path, size_t from, size_t n, uint8_t *dst) {
+  FILE *fp = fopen(R_ExpandFileName(path), "rb");
+  if (fp == NULL) {
+    Rf_error("zap_lazy: Couldn't open file '%s'", path);
+  }
+
+  bool ok = fseeko(fp, (off_t)from, SEEK_SET) == 0 && fread(dst, 1, n, fp) == n;
+  fclose(fp);
+  if (!ok) {
+    Rf_error("zap_lazy: Couldn't read %.0f bytes from '%s'. Has the file changed?",
+             (double)n, path);
+  }
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Decode the vector if this hasn't been done yet
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static SEXP zap_lazy_load(SEXP x_) {
+  SEXP res_ = R_altrep_data2(x_);
+  if (res_ != R_NilValue) {
+    return res_;
+  }
+
+  SEXP info_ = R_altrep_data1(x_);
+  SEXP src_  = VECTOR_ELT(info_, LAZY_SRC);
+  SEXP at_   = VECTOR_ELT(info_, LAZY_AT);
+  SEXP opts_ = VECTOR_ELT(info_, LAZY_OPTS);
+  size_t from = (size_t)Rf_asReal(VECTOR_ELT(info_, LAZY_FROM));
+  size_t n    = (size_t)Rf_asReal(VECTOR_ELT(info_, LAZY_N));
+
+  // Framed entries are a run of blocks which must be followed by an
+  // end-of-stream block (all zeros)
+  bool framed = Rf_asLogical(VECTOR_ELT(at_, 1)) == TRUE;
+  size_t pad  = framed ? FRAME_HEADER_LEN : 0;
+
+  if (TYPEOF(src_) == RAWSXP && from + n > (size_t)Rf_xlength(src_)) {
+    Rf_error("zap_lazy: Entry is beyond the end of the data");
+  }
+
+  if (TYPEOF(src_) == RAWSXP && !framed) {
+    res_ = PROTECT(read_zap_at(RAW(src_) + from, n, at_, opts_));
+  } else {
+    // Keep the bytes in an R vector so they are released if decoding errors
+    SEXP bytes_ = PROTECT(Rf_allocVector(RAWSXP, (R_xlen_t)(n + pad)));
+    if (TYPEOF(src_) == RAWSXP) {
+      memcpy(RAW(bytes_), RAW(src_) + from, n);
+    } else {
+      read_file_bytes(CHAR(STRING_ELT(src_, 0)), from, n, RAW(bytes_));
+    }
+    memset(RAW(bytes_) + n, 0, pad);
+
+    res_ = read_zap_at(RAW(bytes_), n + pad, at_, opts_);
+    UNPROTECT(1);
+    PROTECT(res_);
+  }
+
+  if (TYPEOF(res_) != TYPEOF(x_) || Rf_xlength(res_) != Rf_xlength(x_)) {
+    Rf_error("zap_lazy: Decoded vector does not match the index");
+  }
+
+  R_set_altrep_data2(x_, res_);
+  UNPROTECT(1);
+  return res_;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ALTREP methods
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static R_xlen_t zap_lazy_length(SEXP x_) {
+  return (R_xlen_t)Rf_asReal(VECTOR_ELT(R_altrep_data1(x_), LAZY_LENGTH));
+}
+
+static void *zap_lazy_dataptr(SEXP x_, Rboolean writeable) {
+  return DATAPTR(zap_lazy_load(x_));
+}
+
+static const void *zap_lazy_dataptr_or_null(SEXP x_) {
+  SEXP res_ = R_altrep_data2(x_);
+  return res_ == R_NilValue ? NULL : DATAPTR_RO(res_);
+}
+
+static int zap_lazy_lgl_elt(SEXP x_, R_xlen_t i) {
+  return LOGICAL(zap_lazy_load(x_))[i];
+}
+
+static int zap_lazy_int_elt(SEXP x_, R_xlen_t i) {
+  return INTEGER(zap_lazy_load(x_))[i];
+}
+
+static double zap_lazy_dbl_elt(SEXP x_, R_xlen_t i) {
+  return REAL(zap_lazy_load(x_))[i];
+}
+
+static SEXP zap_lazy_str_elt(SEXP x_, R_xlen_t i) {
+  return STRING_ELT(zap_lazy_load(x_), i);
+}
+
+static void zap_lazy_str_set_elt(SEXP x_, R_xlen_t i, SEXP v_) {
+  SET_STRING_ELT(zap_lazy_load(x_), i, v_);
+}
+
+static Rbyte zap_lazy_raw_elt(SEXP x_, R_xlen_t i) {
+  return RAW(zap_lazy_load(x_))[i];
+}
+
+static Rboolean zap_lazy_inspect(SEXP x_, int pre, int deep, int pvec,
+                                 void (*inspect_subtree)(SEXP, int, int, int)) {
+  Rprintf("zap_lazy %s (len = %.0f, %s)\n", Rf_type2char(TYPEOF(x_)),
+          (double)zap_lazy_length(x_),
+          R_altrep_data2(x_) == R_NilValue ? "not decoded" : "decoded");
+  return TRUE;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Register the ALTREP classes. Called from 'R_init_zap()'
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void set_common_methods(R_altrep_class_t cls) {
+  R_set_altrep_Length_method         (cls, zap_lazy_length);
+  R_set_altrep_Inspect_method        (cls, zap_lazy_inspect);
+  R_set_altvec_Dataptr_method        (cls, zap_lazy_dataptr);
+  R_set_altvec_Dataptr_or_null_method(cls, zap_lazy_dataptr_or_null);
+}
+
+void init_altrep_lazy(DllInfo *dll) {
+  zap_lazy_lgl_class = R_make_altlogical_class("zap_lazy_lgl", "zap", dll);
+  zap_lazy_int_class = R_make_altinteger_class("zap_lazy_int", "zap", dll);
+  zap_lazy_dbl_class = R_make_altreal_class   ("zap_lazy_dbl", "zap", dll);
+  zap_lazy_str_class = R_make_altstring_class ("zap_lazy_str", "zap", dll);
+  zap_lazy_raw_class = R_make_altraw_class    ("zap_lazy_raw", "zap", dll);
+
+  set_common_methods(zap_lazy_lgl_class);
+  set_common_methods(zap_lazy_int_class);
+  set_common_methods(zap_lazy_dbl_class);
+  set_common_methods(zap_lazy_str_class);
+  set_common_methods(zap_lazy_raw_class);
+
+  R_set_altlogical_Elt_method   (zap_lazy_lgl_class, zap_lazy_lgl_elt);
+  R_set_altinteger_Elt_method   (zap_lazy_int_class, zap_lazy_int_elt);
+  R_set_altreal_Elt_method      (zap_lazy_dbl_class, zap_lazy_dbl_elt);
+  R_set_altstring_Elt_method    (zap_lazy_str_class, zap_lazy_str_elt);
+  R_set_altstring_Set_elt_method(zap_lazy_str_class, zap_lazy_str_set_elt);
+  R_set_altraw_Elt_method       (zap_lazy_raw_class, zap_lazy_raw_elt);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Create a vector which is decoded on first use
+//
+// @param info_ list. See 'data1' above
+// @param type_ SEXPTYPE of the vector
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+SEXP zap_lazy_(SEXP info_, SEXP type_) {
+  if (TYPEOF(info_) != VECSXP || Rf_length(info_) != 6) {
+    Rf_error("zap_lazy_(): Bad arguments");
+  }
+
+  R_altrep_class_t cls;
+  switch(Rf_asInteger(type_)) {
+  case LGLSXP:
+    cls = zap_lazy_lgl_class;
+    break;
+  case INTSXP:
+    cls = zap_lazy_int_class;
+    break;
+  case REALSXP:
+    cls = zap_lazy_dbl_class;
+    break;
+  case STRSXP:
+    cls = zap_lazy_str_class;
+    break;
+  case RAWSXP:
+    cls = zap_lazy_raw_class;
+    break;
+  default:
+    Rf_error("zap_lazy_(): Type not supported: %i", Rf_asInteger(type_));
+  }
+
+  return R_new_altrep(cls, info_, R_NilValue);
+}
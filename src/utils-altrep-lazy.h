@@ -0,0 +1,3 @@
+#include <R_ext/Rdynload.h>
+
+void init_altrep_lazy(DllInfo *dll);
@@ -0,0 +1,172 @@
+#define R_NO_REMAP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <R.h>
+#include <Rinternals.h>
+#include <Rdefines.h>
+#include <R_ext/Rdynload.h>
+#include <R_ext/Altrep.h>
+
+#include "utils-altrep-mmap.h"
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// An ALTREP vector whose data is a read-only memory mapping of a file.
+// See 'io-align.h' and 'zap-mmap.c'
+//
+// data1 = external pointer to the first byte of the data.  
+//         The protected value is the external pointer which owns the 
+//         mapping, so the file stays mapped while any vector uses it. 
+//         The tag is the length of the vector.
+// data2 = a copy of the data. NULL until R asks for a writeable pointer
+//
+// The mapping can't be written, so a writeable data pointer is a copy.  
+// Read-only access (e.g. 'sum()', subsetting) uses the mapping directly.
+//
+// Serialization with 'serialize()'/'saveRDS()' and duplication fall back
+// to R's defaults, which write/copy the data as a standard vector.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static R_altrep_class_t zap_mmap_int_class;
+static R_altrep_class_t zap_mmap_dbl_class;
+static R_altrep_class_t zap_mmap_cplx_class;
+static R_altrep_class_t zap_mmap_raw_class;
+
+
+static size_t elem_size(SEXPTYPE type) {
+  switch(type) {
+  case INTSXP:  return sizeof(int32_t);
+  case REALSXP: return sizeof(double);
+  case CPLXSXP: return sizeof(Rcomplex);
+  default:      return 1;
+  }
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// The data. Either the copy or the mapping
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static const void *zap_mmap_data(SEXP x_) {
+  SEXP copy_ = R_altrep_data2(x_);
+  if (copy_ != R_NilValue) {
+    return DATAPTR_RO(copy_);
+  }
+  return R_ExternalPtrAddr(R_altrep_data1(x_));
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ALTREP methods
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static R_xlen_t zap_mmap_length(SEXP x_) {
+  return (R_xlen_t)Rf_asReal(R_ExternalPtrTag(R_altrep_data1(x_)));
+}
+
+static void *zap_mmap_dataptr(SEXP x_, Rboolean writeable) {
+  if (!writeable || R_altrep_data2(x_) != R_NilValue) {
+    return (void *)zap_mmap_data(x_);
+  }
+  
+  R_xlen_t len = zap_mmap_length(x_);
+  SEXP copy_ = PROTECT(Rf_allocVector(TYPEOF(x_), len));
+  memcpy(DATAPTR(copy_), zap_mmap_data(x_), (size_t)len * elem_size(TYPEOF(x_)));
+  R_set_altrep_data2(x_, copy_);
+  UNPROTECT(1);
+  return DATAPTR(copy_);
+}
+
+static const void *zap_mmap_dataptr_or_null(SEXP x_) {
+  return zap_mmap_data(x_);
+}
+
+static int zap_mmap_int_elt(SEXP x_, R_xlen_t i) {
+  return ((const int *)zap_mmap_data(x_))[i];
+}
+
+static double zap_mmap_dbl_elt(SEXP x_, R_xlen_t i) {
+  return ((const double *)zap_mmap_data(x_))[i];
+}
+
+static Rcomplex zap_mmap_cplx_elt(SEXP x_, R_xlen_t i) {
+  return ((const Rcomplex *)zap_mmap_data(x_))[i];
+}
+
+static Rbyte zap_mmap_raw_elt(SEXP x_, R_xlen_t i) {
+  return ((const Rbyte *)zap_mmap_data(x_))[i];
+}
+
+static Rboolean zap_mmap_inspect(SEXP x_, int pre, int deep, int pvec,
+                                 void (*inspect_subtree)(SEXP, int, int, int)) {
+  Rprintf("zap_mmap %s (len = %.0f, %s)\n", Rf_type2char(TYPEOF(x_)),
+          (double)zap_mmap_length(x_),
+          R_altrep_data2(x_) == R_NilValue ? "mapped" : "copied");
+  return TRUE;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Register the ALTREP classes. Called from 'R_init_zap()'
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void set_common_methods(R_altrep_class_t cls) {
+  R_set_altrep_Length_method         (cls, zap_mmap_length);
+  R_set_altrep_Inspect_method        (cls, zap_mmap_inspect);
+  R_set_altvec_Dataptr_method        (cls, zap_mmap_dataptr);
+  R_set_altvec_Dataptr_or_null_method(cls, zap_mmap_dataptr_or_null);
+}
+
+void init_altrep_mmap(DllInfo *dll) {
+  zap_mmap_int_class  = R_make_altinteger_class("zap_mmap_int" , "zap", dll);
+  zap_mmap_dbl_class  = R_make_altreal_class   ("zap_mmap_dbl" , "zap", dll);
+  zap_mmap_cplx_class = R_make_altcomplex_class("zap_mmap_cplx", "zap", dll);
+  zap_mmap_raw_class  = R_make_altraw_class    ("zap_mmap_raw" , "zap", dll);
+
+  set_common_methods(zap_mmap_int_class);
+  set_common_methods(zap_mmap_dbl_class);
+  set_common_methods(zap_mmap_cplx_class);
+  set_common_methods(zap_mmap_raw_class);
+
+  R_set_altinteger_Elt_method(zap_mmap_int_class , zap_mmap_int_elt);
+  R_set_altreal_Elt_method   (zap_mmap_dbl_class , zap_mmap_dbl_elt);
+  R_set_altcomplex_Elt_method(zap_mmap_cplx_class, zap_mmap_cplx_elt);
+  R_set_altraw_Elt_method    (zap_mmap_raw_class , zap_mmap_raw_elt);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Create a vector backed by a mapping
+//
+// @param map_ external pointer which owns the mapping. See 'zap-mmap.c'
+// @param type SEXPTYPE of the vector
+// @param len length of the vector
+// @param data the first byte of the data within the mapping
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+SEXP wrap_mapped_vector(SEXP map_, SEXPTYPE type, R_xlen_t len, uint8_t *data) {
+  R_altrep_class_t cls;
+  switch(type) {
+  case INTSXP:
+    cls = zap_mmap_int_class;
+    break;
+  case REALSXP:
+    cls = zap_mmap_dbl_class;
+    break;
+  case CPLXSXP:
+    cls = zap_mmap_cplx_class;
+    break;
+  case RAWSXP:
+    cls = zap_mmap_raw_class;
+    break;
+  default:
+    Rf_error("wrap_mapped_vector(): Type not supported: %i", type);
+  }
+  
+  SEXP len_ = PROTECT(Rf_ScalarReal((double)len));
+  SEXP ptr_ = PROTECT(R_MakeExternalPtr(data, len_, map_));
+  SEXP res_ = R_new_altrep(cls, ptr_, R_NilValue);
+  UNPROTECT(2);
+  return res_;
+}
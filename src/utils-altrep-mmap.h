@@ -0,0 +1,4 @@
+#include <R_ext/Rdynload.h>
+
+void init_altrep_mmap(DllInfo *dll);
+SEXP wrap_mapped_vector(SEXP map_, SEXPTYPE type, R_xlen_t len, uint8_t *data);
@@ -0,0 +1,127 @@
+#define R_NO_REMAP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include <R.h>
+#include <Rinternals.h>
+#include <Rdefines.h>
+#include <R_ext/Rdynload.h>
+#include <R_ext/Altrep.h>
+
+#include "utils-altrep-raw.h"
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// An ALTREP raw vector which takes ownership of a malloc'd buffer.
+//
+// This lets 'write_zap_()' hand the serialized stream back to R without 
+// allocating a second buffer and copying everything across.
+//
+// data1 = external pointer to an 'owned_buffer_t'. The finalizer frees 
+//         the data when the vector is garbage collected.
+// data2 = unused
+//
+// Serialization with 'serialize()'/'saveRDS()' and duplication fall back 
+// to R's defaults, which write/copy the data as a standard raw vector.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+typedef struct {
+  uint8_t *data;
+  size_t len;
+} owned_buffer_t;
+
+static R_altrep_class_t zap_raw_class;
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Finalizer for the external pointer
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void owned_buffer_finalizer(SEXP ptr_) {
+  owned_buffer_t *buffer = (owned_buffer_t *)R_ExternalPtrAddr(ptr_);
+  if (buffer == NULL) return;
+  free(buffer->data);
+  free(buffer);
+  R_ClearExternalPtr(ptr_);
+}
+
+
+static owned_buffer_t *get_owned_buffer(SEXP x_) {
+  owned_buffer_t *buffer = (owned_buffer_t *)R_ExternalPtrAddr(R_altrep_data1(x_));
+  if (buffer == NULL) {
+    Rf_error("zap_raw: buffer has already been released");
+  }
+  return buffer;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ALTREP methods
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static R_xlen_t zap_raw_length(SEXP x_) {
+  return (R_xlen_t)get_owned_buffer(x_)->len;
+}
+
+static void *zap_raw_dataptr(SEXP x_, Rboolean writeable) {
+  return get_owned_buffer(x_)->data;
+}
+
+static const void *zap_raw_dataptr_or_null(SEXP x_) {
+  return get_owned_buffer(x_)->data;
+}
+
+static Rbyte zap_raw_elt(SEXP x_, R_xlen_t i) {
+  return get_owned_buffer(x_)->data[i];
+}
+
+static Rboolean zap_raw_inspect(SEXP x_, int pre, int deep, int pvec,
+                                void (*inspect_subtree)(SEXP, int, int, int)) {
+  Rprintf("zap_raw (len = %.0f)\n", (double)zap_raw_length(x_));
+  return TRUE;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Register the ALTREP class. Called from 'R_init_zap()'
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void init_altrep_raw(DllInfo *dll) {
+  zap_raw_class = R_make_altraw_class("zap_raw", "zap", dll);
+  
+  R_set_altrep_Length_method         (zap_raw_class, zap_raw_length);
+  R_set_altrep_Inspect_method        (zap_raw_class, zap_raw_inspect);
+  R_set_altvec_Dataptr_method        (zap_raw_class, zap_raw_dataptr);
+  R_set_altvec_Dataptr_or_null_method(zap_raw_class, zap_raw_dataptr_or_null);
+  R_set_altraw_Elt_method            (zap_raw_class, zap_raw_elt);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Wrap a malloc'd buffer as an R raw vector. 
+// Ownership of 'data' passes to the returned vector. 
+//
+// The external pointer and its finalizer are set up first, while it owns 
+// nothing, and 'data' is attached before the ALTREP vector is allocated.
+// If that allocation errors, the finalizer frees 'data' when the pointer
+// is collected.  Only if R can't allocate the pointer itself (before this
+// function has taken ownership) is 'data' left to leak.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+SEXP wrap_raw_buffer(uint8_t *data, size_t len) {
+  SEXP ptr_ = PROTECT(R_MakeExternalPtr(NULL, R_NilValue, R_NilValue));
+  R_RegisterCFinalizerEx(ptr_, owned_buffer_finalizer, TRUE);
+  
+  owned_buffer_t *buffer = malloc(sizeof(owned_buffer_t));
+  if (buffer == NULL) {
+    free(data);
+    Rf_error("wrap_raw_buffer(): malloc failed");
+  }
+  buffer->data = data;
+  buffer->len  = len;
+  R_SetExternalPtrAddr(ptr_, buffer);
+  
+  SEXP res_ = R_new_altrep(zap_raw_class, ptr_, R_NilValue);
+  
+  UNPROTECT(1);
+  return res_;
+}
@@ -0,0 +1,4 @@
+#include <R_ext/Rdynload.h>
+
+void init_altrep_raw(DllInfo *dll);
+SEXP wrap_raw_buffer(uint8_t *data, size_t len);
@@ -111,7 +111,7 @@ size_t deltaframe_encode_ptr_ptr(ctx_t *ctx, void *src, void *dst, size_t n_ints
   // Subtrack the minimum delta so that the deltas are all non-negative
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   uint32_t *tmp = malloc(n_ints * sizeof(uint32_t));
-  if (tmp == NULL) Rf_error("deltaframe_encode_ptr_ptr() malloc(tmp) failed");
+  if (tmp == NULL) ctx_error(ctx, "deltaframe_encode_ptr_ptr() malloc(tmp) failed");
   tmp[0] = 0;
   
   prior = *ref;
@@ -44,7 +44,7 @@
 void write_uint32_buf(ctx_t *ctx, int buf_idx, size_t n_ints) {
   
   if (buf_idx == BUF_SHUF) {
-    Rf_error("write_uint32_buf(): Conflicting buffers: %i", buf_idx);
+    ctx_error(ctx, "write_uint32_buf(): Conflicting buffers: %i", buf_idx);
   }
   
   write_len(ctx, n_ints);
@@ -69,19 +69,31 @@ size_t read_uint32_buf(ctx_t *ctx, int buf_idx) {
     Rf_error("read_uint32_buf(): Conflicting buffers: %i", buf_idx);
   }
   
-  size_t n_ints = read_len(ctx);
-  
-  if (n_ints == 0) {
-    return n_ints;
+  size_t n_ints;
+  uint8_t *src = borrow_uint32_buf(ctx, BUF_SHUF, &n_ints);
+  if (n_ints > 0) {
+    unshuffle_delta4_ptr_buf(ctx, src, buf_idx, n_ints);
   }
   
-  read_buf(ctx, BUF_SHUF);
-  unshuffle_delta4_buf_buf(ctx, BUF_SHUF, buf_idx, n_ints);
-  
   return n_ints;
 }
 
 
-
-
-
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Borrow the still-shuffled bytes of uint32_t's written with 
+// 'write_uint32_buf()'.  See 'borrow_buf()'.  
+// Decode later with 'unshuffle_delta4_ptr_buf()'
+//
+// @param buf_idx buffer to use if the bytes must be copied
+// @param n_ints number of uint32_ts
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+uint8_t *borrow_uint32_buf(ctx_t *ctx, int buf_idx, size_t *n_ints) {
+  
+  *n_ints = read_len(ctx);
+  if (*n_ints == 0) {
+    return NULL;
+  }
+  
+  size_t nbytes;
+  return borrow_buf(ctx, buf_idx, &nbytes, 1);
+}
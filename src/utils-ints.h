@@ -1,4 +1,5 @@
 
 void write_uint32_buf(ctx_t *ctx, int buf_idx, size_t n_ints);
 size_t read_uint32_buf(ctx_t *ctx, int buf_idx);
+uint8_t *borrow_uint32_buf(ctx_t *ctx, int buf_idx, size_t *n_ints);
 
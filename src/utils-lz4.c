@@ -0,0 +1,242 @@
+#define R_NO_REMAP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "utils-lz4.h"
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// LZ4 block format
+// https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+//
+// A block is a series of sequences:
+//   [token] [literal length ...] [literals] [offset] [match length ...]
+//
+//   - token: upper 4 bits literal length, lower 4 bits match length - 4. 
+//     A value of 15 means more length bytes follow, each added to the 
+//     length until a byte other than 255
+//   - offset: distance back to the match (uint16_t, little endian)
+//
+// The final sequence holds only literals.  The last 5 bytes are always 
+// literals, and the last match starts at least 12 bytes before the end.
+//
+// The compressor is a simple greedy matcher with a single hash table of 
+// the most recent position of each 4-byte sequence.  It favours speed over
+// ratio. Runs without matches are skipped at an increasing stride so that
+// incompressible data passes through quickly.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#define LZ4_HASH_LOG      12
+#define LZ4_MIN_MATCH      4
+#define LZ4_MAX_OFFSET    65535
+#define LZ4_LAST_LITERALS  5
+#define LZ4_MF_LIMIT      12
+#define LZ4_SKIP_TRIGGER   6
+
+
+static inline uint32_t read_u32(uint8_t *p) {
+  uint32_t val;
+  memcpy(&val, p, sizeof(uint32_t));
+  return val;
+}
+
+static inline uint32_t hash_u32(uint32_t val) {
+  return (val * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Write a length which did not fit in the token
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static inline uint8_t *put_length(uint8_t *op, size_t len) {
+  while (len >= 255) {
+    *op++ = 255;
+    len -= 255;
+  }
+  *op++ = (uint8_t)len;
+  return op;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Write one sequence.  'mlen' is 0 for the final literals-only sequence
+// @return position after the sequence. NULL if it does not fit
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static uint8_t *put_sequence(uint8_t *op, uint8_t *oend, uint8_t *lit, size_t litlen,
+                             size_t offset, size_t mlen) {
+  
+  size_t need = 1 + litlen / 255 + 1 + litlen;
+  if (mlen > 0) need += 2 + mlen / 255 + 1;
+  if (need > (size_t)(oend - op)) return NULL;
+  
+  uint8_t *token = op++;
+  *token = (uint8_t)((litlen >= 15 ? 15 : litlen) << 4);
+  if (litlen >= 15) {
+    op = put_length(op, litlen - 15);
+  }
+  memcpy(op, lit, litlen);
+  op += litlen;
+  
+  if (mlen == 0) return op;
+  
+  *op++ = (uint8_t)(offset     );
+  *op++ = (uint8_t)(offset >> 8);
+  
+  size_t ml = mlen - LZ4_MIN_MATCH;
+  *token |= (uint8_t)(ml >= 15 ? 15 : ml);
+  if (ml >= 15) {
+    op = put_length(op, ml - 15);
+  }
+  
+  return op;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Compress 'len' bytes 
+//
+// @param capacity bytes available at 'dst'
+// @return the compressed length. 0 if it does not fit in 'capacity'
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+size_t lz4_compress_ptr_ptr(uint8_t *src, size_t len, uint8_t *dst, size_t capacity) {
+  
+  // Position of the last occurrence of each hashed 4-byte sequence. 
+  // Candidates are always checked, so stale or zero entries are harmless
+  uint32_t table[1 << LZ4_HASH_LOG];
+  memset(table, 0, sizeof(table));
+  
+  uint8_t *ip     = src;
+  uint8_t *anchor = src;       // Start of pending literals
+  uint8_t *iend   = src + len;
+  uint8_t *op     = dst;
+  uint8_t *oend   = dst + capacity;
+  
+  if (len > LZ4_MF_LIMIT) {
+    uint8_t *mflimit    = iend - LZ4_MF_LIMIT;
+    uint8_t *matchlimit = iend - LZ4_LAST_LITERALS;
+    
+    ip++;
+    while (ip < mflimit) {
+      uint32_t seq = read_u32(ip);
+      uint32_t h   = hash_u32(seq);
+      uint8_t *ref = src + table[h];
+      table[h] = (uint32_t)(ip - src);
+      
+      if (ref >= ip || ip - ref > LZ4_MAX_OFFSET || read_u32(ref) != seq) {
+        ip += 1 + ((size_t)(ip - anchor) >> LZ4_SKIP_TRIGGER);
+        continue;
+      }
+      
+      // Extend the match backwards over pending literals, then forwards
+      while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+        ip--;
+        ref--;
+      }
+      uint8_t *mend = ip + LZ4_MIN_MATCH;
+      uint8_t *rend = ref + LZ4_MIN_MATCH;
+      while (mend < matchlimit && *mend == *rend) {
+        mend++;
+        rend++;
+      }
+      
+      op = put_sequence(op, oend, anchor, (size_t)(ip - anchor), 
+                        (size_t)(ip - ref), (size_t)(mend - ip));
+      if (op == NULL) return 0;
+      
+      ip     = mend;
+      anchor = mend;
+      
+      // Fill in a position within the match for later matches to find
+      if (ip < mflimit) {
+        table[hash_u32(read_u32(ip - 2))] = (uint32_t)(ip - 2 - src);
+      }
+    }
+  }
+  
+  op = put_sequence(op, oend, anchor, (size_t)(iend - anchor), 0, 0);
+  if (op == NULL) return 0;
+  
+  return (size_t)(op - dst);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Decompress a block which must expand to exactly 'ulen' bytes.
+// Every length and offset is checked, so corrupt data can't read or 
+// write out of bounds.
+//
+// @return true on success
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+bool lz4_decompress_ptr_ptr(uint8_t *src, size_t clen, uint8_t *dst, size_t ulen) {
+  
+  uint8_t *ip   = src;
+  uint8_t *iend = src + clen;
+  uint8_t *op   = dst;
+  uint8_t *oend = dst + ulen;
+  
+  while (ip < iend) {
+    uint8_t token = *ip++;
+    
+    // Literals
+    size_t litlen = token >> 4;
+    if (litlen == 15) {
+      uint8_t b;
+      do {
+        if (ip >= iend) return false;
+        b = *ip++;
+        litlen += b;
+      } while (b == 255);
+    }
+    if (litlen > (size_t)(iend - ip) || litlen > (size_t)(oend - op)) return false;
+    memcpy(op, ip, litlen);
+    op += litlen;
+    ip += litlen;
+    
+    // The final sequence has no match
+    if (ip == iend) break;
+    
+    // Match
+    if (iend - ip < 2) return false;
+    size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > (size_t)(op - dst)) return false;
+    
+    size_t mlen = token & 15;
+    if (mlen == 15) {
+      uint8_t b;
+      do {
+        if (ip >= iend) return false;
+        b = *ip++;
+        mlen += b;
+      } while (b == 255);
+    }
+    mlen += LZ4_MIN_MATCH;
+    if (mlen > (size_t)(oend - op)) return false;
+    
+    // Overlapping matches (offset < mlen) repeat the last 'offset' bytes,
+    // so must be copied in steps of at most 'offset' bytes
+    uint8_t *match = op - offset;
+    if (offset >= mlen) {
+      memcpy(op, match, mlen);
+    } else if (offset >= 8) {
+      size_t i = 0;
+      for (; i + 8 <= mlen; i += 8) {
+        memcpy(op + i, match + i, 8);
+      }
+      for (; i < mlen; i++) {
+        op[i] = match[i];
+      }
+    } else {
+      for (size_t i = 0; i < mlen; i++) {
+        op[i] = match[i];
+      }
+    }
+    op += mlen;
+  }
+  
+  return op == oend;
+}
@@ -0,0 +1,9 @@
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// LZ4 block compression. See 'utils-lz4.c'
+//
+// No R API calls. Safe to call from a worker thread.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+size_t lz4_compress_ptr_ptr(uint8_t *src, size_t len, uint8_t *dst, size_t capacity);
+bool lz4_decompress_ptr_ptr(uint8_t *src, size_t clen, uint8_t *dst, size_t ulen);
@@ -14,6 +14,7 @@
 #include <Rdefines.h>
 
 #include "io-ctx.h"
+#include "utils-packing-1bit.h"
 
 
 
@@ -145,13 +146,29 @@ void unpack_na_str(ctx_t *ctx, int BUF_IDX, SEXP x_, size_t len) {
 //         Data is in ctx->buf[BUF_IDX]
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 size_t pack_na_int(ctx_t *ctx, int BUF_IDX, SEXP x_) {
+  return pack_na_int_ptr(ctx, BUF_IDX, INTEGER(x_), (size_t)Rf_xlength(x_));
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Allocate 1-bit per element in 'x' and use it to indicate if value
+// at this location is NA
+//
+// @param ctx zap context
+// @param BUF_IDX which buffer to use to hold result
+// @param x integer data
+// @param len number of elements in 'x'
+//
+// @return nbytes in bitstream written to output buffer
+//         Data is in ctx->buf[BUF_IDX]
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+size_t pack_na_int_ptr(ctx_t *ctx, int BUF_IDX, int32_t *x, size_t len) {
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // len              - how many original values
   // n_container_ints - how many uint32s are needed to hold the NA bitstream?
   // packed_len       - how many bytes are needed to hold the NA bitstream?
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  size_t len              = (size_t)Rf_length(x_);
   size_t n_container_ints = (size_t)ceil((double)len/(8.0 * sizeof(uint32_t)));
   size_t packed_len       = n_container_ints * sizeof(uint32_t);
   
@@ -171,7 +188,6 @@ size_t pack_na_int(ctx_t *ctx, int BUF_IDX, SEXP x_) {
   //   is this an NA string?
   //   add the boolean bit to the current int
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  int32_t *x = INTEGER(x_);
   int i = 0;
   for (; i < (int64_t)len - (32 - 1); i += 32) {
     *nap = 0;
@@ -182,7 +198,7 @@ size_t pack_na_int(ctx_t *ctx, int BUF_IDX, SEXP x_) {
   }
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  // The input vector (x_) is unlikely to be an exact multiple of 32, 
+  // The input vector 'x' is unlikely to be an exact multiple of 32, 
   // so there are leftovers to process
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   if (i < len) {
@@ -209,10 +225,22 @@ size_t pack_na_int(ctx_t *ctx, int BUF_IDX, SEXP x_) {
 // @return None.  x_ modified in-place
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 void unpack_na_int(ctx_t *ctx, int BUF_IDX, SEXP x_, size_t len) {
+  unpack_na_int_ptr_ptr(ctx, ctx->buf[BUF_IDX], INTEGER(x_), len);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Unpack a binary bitstream to set NA values in 'x'
+//
+// No R API calls. Safe to call from a worker thread.
+//
+// @param src bitstream. Must be aligned for uint32_t access
+// @param x integer data
+// @param len number of elements to unpack
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void unpack_na_int_ptr_ptr(ctx_t *ctx, void *src, int32_t *x, size_t len) {
   
-  int32_t *x = INTEGER(x_);
-  
-  uint32_t *nap = (uint32_t *)ctx->buf[BUF_IDX];
+  uint32_t *nap = (uint32_t *)src;
   int i = 0;
   for (; i < (int32_t)len - (32 - 1); i += 32) {
     if (*nap != 0) {
@@ -248,13 +276,29 @@ void unpack_na_int(ctx_t *ctx, int BUF_IDX, SEXP x_, size_t len) {
 //         Data is in ctx->buf[BUF_IDX]
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 size_t pack_lgl(ctx_t *ctx, int BUF_IDX, SEXP x_) {
+  return pack_lgl_ptr(ctx, BUF_IDX, LOGICAL(x_), (size_t)Rf_xlength(x_));
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Allocate 1-bit per element in 'x' and use it to indicate if value
+// at this location is true
+//
+// @param ctx zap context
+// @param BUF_IDX which buffer to use to hold result
+// @param x logical data
+// @param len number of elements in 'x'
+//
+// @return nbytes in bitstream written to output buffer
+//         Data is in ctx->buf[BUF_IDX]
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+size_t pack_lgl_ptr(ctx_t *ctx, int BUF_IDX, int32_t *x, size_t len) {
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // len              - how many original values
   // n_container_ints - how many uint32s are needed to hold the NA bitstream?
   // packed_len       - how many bytes are needed to hold the NA bitstream?
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  size_t len              = (size_t)Rf_length(x_);
   size_t n_container_ints = (size_t)ceil((double)len/(8.0 * sizeof(uint32_t)));
   size_t packed_len       = n_container_ints * sizeof(uint32_t);
   
@@ -274,7 +318,6 @@ size_t pack_lgl(ctx_t *ctx, int BUF_IDX, SEXP x_) {
   //   is this an NA string?
   //   add the boolean bit to the current int
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  int32_t *x = LOGICAL(x_);
   int i = 0;
   for (; i < (int64_t)len - (32 - 1); i += 32) {
     *nap = 0;
@@ -285,7 +328,7 @@ size_t pack_lgl(ctx_t *ctx, int BUF_IDX, SEXP x_) {
   }
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  // The input vector (x_) is unlikely to be an exact multiple of 32, 
+  // The input vector 'x' is unlikely to be an exact multiple of 32, 
   // so there are leftovers to process
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   if (i < len) {
@@ -312,10 +355,23 @@ size_t pack_lgl(ctx_t *ctx, int BUF_IDX, SEXP x_) {
 // @return None.  x_ modified in-place
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 void unpack_lgl(ctx_t *ctx, int BUF_IDX, SEXP x_, size_t len) {
+  unpack_lgl_ptr_ptr(ctx, ctx->buf[BUF_IDX], LOGICAL(x_), len);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Unpack a binary bitstream to set logical values in 'x'
+// 'x' must be zeroed beforehand.
+//
+// No R API calls. Safe to call from a worker thread.
+//
+// @param src bitstream. Must be aligned for uint32_t access
+// @param x logical data
+// @param len number of elements to unpack
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void unpack_lgl_ptr_ptr(ctx_t *ctx, void *src, int32_t *x, size_t len) {
   
-  int32_t *x = LOGICAL(x_);
-  
-  uint32_t *nap = (uint32_t *)ctx->buf[BUF_IDX];
+  uint32_t *nap = (uint32_t *)src;
   int i = 0;
   for (; i < (int32_t)len - (32 - 1); i += 32) {
     if (*nap != 0) {
@@ -3,7 +3,11 @@ size_t pack_na_str(ctx_t *ctx, int BUF_IDX, SEXP x_);
 void unpack_na_str(ctx_t *ctx, int BUF_IDX, SEXP x_, size_t len);
 
 size_t pack_na_int(ctx_t *ctx, int BUF_IDX, SEXP x_);
+size_t pack_na_int_ptr(ctx_t *ctx, int BUF_IDX, int32_t *x, size_t len);
 void unpack_na_int(ctx_t *ctx, int BUF_IDX, SEXP x_, size_t len);
+void unpack_na_int_ptr_ptr(ctx_t *ctx, void *src, int32_t *x, size_t len);
 
 size_t pack_lgl(ctx_t *ctx, int BUF_IDX, SEXP x_);
+size_t pack_lgl_ptr(ctx_t *ctx, int BUF_IDX, int32_t *x, size_t len);
 void unpack_lgl(ctx_t *ctx, int BUF_IDX, SEXP x_, size_t len);
+void unpack_lgl_ptr_ptr(ctx_t *ctx, void *src, int32_t *x, size_t len);
@@ -0,0 +1,188 @@
+#define R_NO_REMAP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <R.h>
+#include <Rinternals.h>
+#include <Rdefines.h>
+
+#include "utils-pool.h"
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Pool state.
+//
+// Workers sleep on 'work_cv' until 'generation' changes, then claim task
+// indices from 'next' until all are taken.  The last task to finish
+// signals 'done_cv'.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+struct pool_s {
+  pthread_t threads[POOL_MAX_THREADS];
+  int nworkers;
+
+  pthread_mutex_t lock;
+  pthread_cond_t  work_cv;
+  pthread_cond_t  done_cv;
+
+  // Current batch of tasks
+  void (*fn)(void *arg, size_t idx);
+  void *arg;
+  size_t ntasks;
+  size_t next;
+  size_t ndone;
+
+  uint64_t generation;
+  bool shutdown;
+};
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Claim and run tasks until none remain.
+// Called with the lock held. Returns with the lock held.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void run_tasks(pool_t *pool) {
+  while (pool->next < pool->ntasks) {
+    size_t idx = pool->next++;
+    pthread_mutex_unlock(&pool->lock);
+    pool->fn(pool->arg, idx);
+    pthread_mutex_lock(&pool->lock);
+    pool->ndone++;
+    if (pool->ndone == pool->ntasks) {
+      pthread_cond_broadcast(&pool->done_cv);
+    }
+  }
+}
+
+
+static void *worker(void *data) {
+  pool_t *pool = (pool_t *)data;
+  uint64_t seen = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  while (true) {
+    while (!pool->shutdown && pool->generation == seen) {
+      pthread_cond_wait(&pool->work_cv, &pool->lock);
+    }
+    if (pool->shutdown) break;
+    seen = pool->generation;
+    run_tasks(pool);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Create a pool.
+// 'nthreads' includes the calling thread, so 'nthreads - 1' workers are
+// started.  If threads cannot be created, the pool runs with fewer.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+pool_t *pool_create(int nthreads) {
+  pool_t *pool = calloc(1, sizeof(pool_t));
+  if (pool == NULL) Rf_error("pool_create(): malloc failed");
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work_cv, NULL);
+  pthread_cond_init(&pool->done_cv, NULL);
+
+  if (nthreads > POOL_MAX_THREADS) nthreads = POOL_MAX_THREADS;
+
+  for (int i = 0; i < nthreads - 1; i++) {
+    if (pthread_create(&pool->threads[pool->nworkers], NULL, worker, pool) != 0) {
+      break;
+    }
+    pool->nworkers++;
+  }
+
+  return pool;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Start 'ntasks' tasks on the workers and return without waiting.
+// Any previous batch must have been waited for.  If there are no workers
+// the tasks are run immediately.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void pool_submit(pool_t *pool, size_t ntasks, void (*fn)(void *arg, size_t idx), void *arg) {
+  if (ntasks == 0) return;
+
+  if (pool == NULL || pool->nworkers == 0) {
+    for (size_t i = 0; i < ntasks; i++) {
+      fn(arg, i);
+    }
+    return;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->fn     = fn;
+  pool->arg    = arg;
+  pool->ntasks = ntasks;
+  pool->next   = 0;
+  pool->ndone  = 0;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->work_cv);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Wait for the current batch to complete.
+// The calling thread runs any tasks which have not yet been claimed.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void pool_wait(pool_t *pool) {
+  if (pool == NULL || pool->nworkers == 0) return;
+
+  pthread_mutex_lock(&pool->lock);
+  run_tasks(pool);
+  while (pool->ndone < pool->ntasks) {
+    pthread_cond_wait(&pool->done_cv, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Run 'ntasks' tasks and wait for them all to complete.
+// The calling thread also runs tasks.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void pool_run(pool_t *pool, size_t ntasks, void (*fn)(void *arg, size_t idx), void *arg) {
+  if (ntasks == 0) return;
+
+  if (pool == NULL || pool->nworkers == 0 || ntasks == 1) {
+    for (size_t i = 0; i < ntasks; i++) {
+      fn(arg, i);
+    }
+    return;
+  }
+
+  pool_submit(pool, ntasks, fn, arg);
+  pool_wait(pool);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Stop all workers and free the pool
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void pool_destroy(pool_t *pool) {
+  if (pool == NULL) return;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->shutdown = true;
+  pthread_cond_broadcast(&pool->work_cv);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (int i = 0; i < pool->nworkers; i++) {
+    pthread_join(pool->threads[i], NULL);
+  }
+
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->work_cv);
+  pthread_cond_destroy(&pool->done_cv);
+  free(pool);
+}
@@ -0,0 +1,27 @@
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// A minimal pthread pool
+//
+// 'pool_run()' calls 'fn(arg, i)' for every 'i' in [0, ntasks) spread across
+// the pool's threads and the calling thread, and returns once all tasks
+// are complete.
+//
+// 'pool_submit()' starts a batch of tasks on the workers only and returns
+// straight away, so the caller can do other work in the meantime. 
+// 'pool_wait()' then waits for the batch to complete.  Only one batch may
+// be in flight at a time.
+//
+// Tasks run outside of R's main thread and must not call any R API
+// functions (no allocation, no Rf_error()). Record failures in 'arg' and
+// raise any error after 'pool_run()' returns.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#define POOL_MAX_THREADS 64
+
+typedef struct pool_s pool_t;
+
+pool_t *pool_create(int nthreads);
+void pool_run(pool_t *pool, size_t ntasks, void (*fn)(void *arg, size_t idx), void *arg);
+void pool_submit(pool_t *pool, size_t ntasks, void (*fn)(void *arg, size_t idx), void *arg);
+void pool_wait(pool_t *pool);
+void pool_destroy(pool_t *pool);
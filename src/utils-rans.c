@@ -0,0 +1,484 @@
+#define R_NO_REMAP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include <R.h>
+#include <Rinternals.h>
+#include <Rdefines.h>
+
+#include "io-ctx.h"
+#include "utils-rans.h"
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Order-0 rANS with byte-wise renormalisation
+//
+// Follows Fabian Giesen's 'rans_byte.h'
+//   - https://github.com/rygorous/ryg_rans
+//
+// The state is a uint32_t in [RANS_L, RANS_L << 8).  Frequencies are
+// scaled to sum to RANS_SCALE.  Symbols are interleaved over 4 states
+// (symbol 'i' uses state 'i % 4') which share a single byte stream, so
+// that decoding has 4 independent dependency chains.
+//
+// The encoder works backwards from the end of the plane, writing bytes
+// backwards, so the decoder reads forwards.  The encoder divides using
+// a reciprocal of each frequency.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#define RANS_SCALE_BITS 12
+#define RANS_SCALE      (1u << RANS_SCALE_BITS)
+#define RANS_L          (1u << 23)
+
+// Shorter planes are stored raw
+#define RANS_MIN_LEN    256
+
+typedef struct {
+  uint32_t x_max;     // Renormalise while the state is at least this
+  uint32_t rcp_freq;  // Fixed point reciprocal of the frequency
+  uint32_t bias;
+  uint16_t cmpl_freq; // RANS_SCALE - frequency
+  uint16_t rcp_shift;
+} enc_sym_t;
+
+
+static void enc_sym_init(enc_sym_t *s, uint32_t start, uint32_t freq) {
+  s->x_max     = ((RANS_L >> RANS_SCALE_BITS) << 8) * freq;
+  s->cmpl_freq = (uint16_t)(RANS_SCALE - freq);
+  if (freq < 2) {
+    s->rcp_freq  = ~0u;
+    s->rcp_shift = 0;
+    s->bias      = start + RANS_SCALE - 1;
+  } else {
+    uint32_t shift = 0;
+    while (freq > (1u << shift)) {
+      shift++;
+    }
+    s->rcp_freq  = (uint32_t)(((1ull << (shift + 31)) + freq - 1) / freq);
+    s->rcp_shift = (uint16_t)(shift - 1);
+    s->bias      = start;
+  }
+  s->rcp_shift += 32;
+}
+
+
+static inline uint32_t enc_put(uint32_t x, uint8_t **pptr, enc_sym_t *s) {
+  if (x >= s->x_max) {
+    uint8_t *ptr = *pptr;
+    do {
+      *--ptr = (uint8_t)(x & 0xff);
+      x >>= 8;
+    } while (x >= s->x_max);
+    *pptr = ptr;
+  }
+  uint32_t q = (uint32_t)(((uint64_t)x * s->rcp_freq) >> s->rcp_shift);
+  return x + s->bias + q * s->cmpl_freq;
+}
+
+
+static inline void enc_flush(uint32_t x, uint8_t **pptr) {
+  uint8_t *ptr = *pptr - 4;
+  ptr[0] = (uint8_t)(x >>  0);
+  ptr[1] = (uint8_t)(x >>  8);
+  ptr[2] = (uint8_t)(x >> 16);
+  ptr[3] = (uint8_t)(x >> 24);
+  *pptr = ptr;
+}
+
+
+static inline uint32_t get_u32(uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+    ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+static inline void put_u32(uint8_t *p, uint32_t x) {
+  p[0] = (uint8_t)(x >>  0);
+  p[1] = (uint8_t)(x >>  8);
+  p[2] = (uint8_t)(x >> 16);
+  p[3] = (uint8_t)(x >> 24);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Count bytes. 4 tables avoid stalls on runs of the same byte
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void histogram(uint8_t *src, size_t len, uint32_t *count) {
+  uint32_t c[4][256];
+  memset(c, 0, sizeof(c));
+
+  size_t i = 0;
+  for (; i + 4 <= len; i += 4) {
+    c[0][src[i    ]]++;
+    c[1][src[i + 1]]++;
+    c[2][src[i + 2]]++;
+    c[3][src[i + 3]]++;
+  }
+  for (; i < len; i++) {
+    c[0][src[i]]++;
+  }
+
+  for (int s = 0; s < 256; s++) {
+    count[s] = c[0][s] + c[1][s] + c[2][s] + c[3][s];
+  }
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Scale counts to frequencies which sum to RANS_SCALE. Every symbol
+// present gets a frequency of at least 1
+//
+// @return number of symbols present
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static int normalize_freqs(uint32_t *count, size_t len, uint32_t *freq) {
+
+  uint32_t total = 0;
+  int nsym  = 0;
+  int max_s = 0;
+
+  for (int s = 0; s < 256; s++) {
+    freq[s] = 0;
+    if (count[s] == 0) continue;
+    uint32_t f = (uint32_t)(((uint64_t)count[s] * RANS_SCALE) / len);
+    freq[s] = f > 0 ? f : 1;
+    total += freq[s];
+    nsym++;
+    if (freq[s] > freq[max_s]) max_s = s;
+  }
+
+  if (total < RANS_SCALE) {
+    freq[max_s] += RANS_SCALE - total;
+  }
+
+  // Many rare symbols raised to 1 can overshoot.  Take the excess from
+  // the most frequent symbols
+  while (total > RANS_SCALE) {
+    max_s = 0;
+    for (int s = 1; s < 256; s++) {
+      if (freq[s] > freq[max_s]) max_s = s;
+    }
+    freq[max_s]--;
+    total--;
+  }
+
+  return nsym;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// rANS code 'len' bytes backwards into [lo, hi)
+//
+// @return number of bytes written (which end at 'hi'), or 0 if they
+//         don't fit
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static size_t encode_plane(uint8_t *src, size_t len, uint32_t *freq,
+                           uint8_t *lo, uint8_t *hi) {
+
+  enc_sym_t sym[256];
+  uint32_t start = 0;
+  for (int s = 0; s < 256; s++) {
+    if (freq[s] == 0) continue;
+    enc_sym_init(&sym[s], start, freq[s]);
+    start += freq[s];
+  }
+
+  uint32_t r0 = RANS_L, r1 = RANS_L, r2 = RANS_L, r3 = RANS_L;
+  uint8_t *ptr = hi;
+
+  // Each symbol writes at most 2 bytes. Keep room for the final states
+  size_t i = len;
+  while (i & 3) {
+    if ((size_t)(ptr - lo) < 2 + 16) return 0;
+    i--;
+    switch (i & 3) {
+    case 0: r0 = enc_put(r0, &ptr, &sym[src[i]]); break;
+    case 1: r1 = enc_put(r1, &ptr, &sym[src[i]]); break;
+    case 2: r2 = enc_put(r2, &ptr, &sym[src[i]]); break;
+    }
+  }
+
+  while (i > 0) {
+    if ((size_t)(ptr - lo) < 8 + 16) return 0;
+    i -= 4;
+    r3 = enc_put(r3, &ptr, &sym[src[i + 3]]);
+    r2 = enc_put(r2, &ptr, &sym[src[i + 2]]);
+    r1 = enc_put(r1, &ptr, &sym[src[i + 1]]);
+    r0 = enc_put(r0, &ptr, &sym[src[i    ]]);
+  }
+
+  enc_flush(r3, &ptr);
+  enc_flush(r2, &ptr);
+  enc_flush(r1, &ptr);
+  enc_flush(r0, &ptr);
+
+  return (size_t)(hi - ptr);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Code a single plane into 'dst' which has room for 'len + 1024' bytes
+//
+// @return number of bytes written
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static size_t encode_plane_or_raw(uint8_t *src, size_t len, uint8_t *dst) {
+
+  if (len < RANS_MIN_LEN || len > UINT32_MAX) {
+    goto raw;
+  }
+
+  uint32_t count[256];
+  uint32_t freq[256];
+  histogram(src, len, count);
+  int nsym = normalize_freqs(count, len, freq);
+
+  if (nsym == 1) {
+    dst[0] = RANS_PLANE_CONST;
+    dst[1] = src[0];
+    return 2;
+  }
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Estimate the coded size from the histogram, and don't bother coding
+  // planes which would save less than 1/32 of their size
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  double bits = 0;
+  for (int s = 0; s < 256; s++) {
+    if (count[s] > 0) {
+      bits += count[s] * (RANS_SCALE_BITS - log2((double)freq[s]));
+    }
+  }
+  size_t estimate = (size_t)(bits / 8) + 32 + 2 * (size_t)nsym + 4 + 16;
+  if (estimate >= len - len / 32) {
+    goto raw;
+  }
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // [RANS_PLANE_RANS] [present] [freqs]
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  uint8_t *op = dst;
+  *op++ = RANS_PLANE_RANS;
+
+  uint8_t *present = op;
+  memset(present, 0, 32);
+  op += 32;
+  for (int s = 0; s < 256; s++) {
+    if (freq[s] == 0) continue;
+    present[s >> 3] |= (uint8_t)(1u << (s & 7));
+    uint32_t f = freq[s] - 1;
+    if (f < 128) {
+      *op++ = (uint8_t)f;
+    } else {
+      *op++ = (uint8_t)(0x80 | (f >> 8));
+      *op++ = (uint8_t)(f & 0xff);
+    }
+  }
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // [clen] [coded bytes]. Code backwards into the space a raw plane would
+  // take, then move the bytes down
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  uint8_t *data = op + 4;
+  size_t hdr_len = (size_t)(data - dst);
+  if (hdr_len + 16 >= len) {
+    goto raw;
+  }
+  uint8_t *hi = dst + len;
+  size_t clen = encode_plane(src, len, freq, data, hi);
+  if (clen == 0) {
+    goto raw;
+  }
+  memmove(data, hi - clen, clen);
+  put_u32(op, (uint32_t)clen);
+  return hdr_len + clen;
+
+  raw:
+  dst[0] = RANS_PLANE_RAW;
+  memcpy(dst + 1, src, len);
+  return len + 1;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Decode 'len' bytes from 'clen' coded bytes
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static bool decode_plane(uint8_t *src, size_t clen, uint32_t *freq,
+                         uint8_t *dst, size_t len) {
+
+  // For each slot: [symbol] [frequency] [slot - start of symbol]
+  // packed in 8 + 12 + 12 bits
+  uint32_t slots[RANS_SCALE];
+  uint32_t cum = 0;
+  for (uint32_t s = 0; s < 256; s++) {
+    for (uint32_t k = 0; k < freq[s]; k++) {
+      slots[cum + k] = s | (freq[s] << 8) | (k << 20);
+    }
+    cum += freq[s];
+  }
+
+  if (clen < 16) return false;
+  uint8_t *ptr = src;
+  uint8_t *end = src + clen;
+  uint32_t r[4];
+  for (int k = 0; k < 4; k++) {
+    r[k] = get_u32(ptr);
+    ptr += 4;
+  }
+
+#define DECODE_SYM(x, i)                                                 \
+  {                                                                      \
+    uint32_t e = slots[(x) & (RANS_SCALE - 1)];                          \
+    dst[i] = (uint8_t)e;                                                 \
+    (x) = ((e >> 8) & 0xfff) * ((x) >> RANS_SCALE_BITS) + (e >> 20);     \
+  }
+
+  // While at least 8 bytes remain, 4 symbols can renormalise unchecked
+  size_t i = 0;
+  uint32_t r0 = r[0], r1 = r[1], r2 = r[2], r3 = r[3];
+  for (; i + 4 <= len && end - ptr >= 8; i += 4) {
+    DECODE_SYM(r0, i    );
+    DECODE_SYM(r1, i + 1);
+    DECODE_SYM(r2, i + 2);
+    DECODE_SYM(r3, i + 3);
+    while (r0 < RANS_L) r0 = (r0 << 8) | *ptr++;
+    while (r1 < RANS_L) r1 = (r1 << 8) | *ptr++;
+    while (r2 < RANS_L) r2 = (r2 << 8) | *ptr++;
+    while (r3 < RANS_L) r3 = (r3 << 8) | *ptr++;
+  }
+  r[0] = r0; r[1] = r1; r[2] = r2; r[3] = r3;
+
+  for (; i < len; i++) {
+    uint32_t x = r[i & 3];
+    DECODE_SYM(x, i);
+    while (x < RANS_L) {
+      if (ptr >= end) return false;
+      x = (x << 8) | *ptr++;
+    }
+    r[i & 3] = x;
+  }
+
+#undef DECODE_SYM
+
+  // All input consumed and the states are back where the encoder started
+  return ptr == end && r[0] == RANS_L && r[1] == RANS_L &&
+    r[2] == RANS_L && r[3] == RANS_L;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Read [present] [freqs]. Frequencies must sum to RANS_SCALE, so with 2
+// or more symbols each is below RANS_SCALE (see 'decode_plane()')
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static bool read_freqs(uint8_t **pptr, uint8_t *end, uint32_t *freq) {
+  uint8_t *ptr = *pptr;
+  if (end - ptr < 32) return false;
+  uint8_t *present = ptr;
+  ptr += 32;
+
+  uint32_t total = 0;
+  for (int s = 0; s < 256; s++) {
+    freq[s] = 0;
+    if (!(present[s >> 3] & (1u << (s & 7)))) continue;
+    if (ptr >= end) return false;
+    uint32_t f = *ptr++;
+    if (f & 0x80) {
+      if (ptr >= end) return false;
+      f = ((f & 0x7f) << 8) | *ptr++;
+    }
+    freq[s] = f + 1;
+    if (freq[s] >= RANS_SCALE) return false;
+    total += freq[s];
+  }
+
+  *pptr = ptr;
+  return total == RANS_SCALE;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Code 'nplanes' planes of 'plane_len' bytes
+//
+// @param dst room for RANS_BOUND(nplanes, plane_len) bytes
+// @return number of bytes written
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+size_t rans_encode_ptr_ptr(uint8_t *src, size_t nplanes, size_t plane_len, uint8_t *dst) {
+  uint8_t *op = dst;
+  for (size_t k = 0; k < nplanes; k++) {
+    op += encode_plane_or_raw(src + k * plane_len, plane_len, op);
+  }
+  return (size_t)(op - dst);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Decode 'nplanes' planes of 'plane_len' bytes from exactly 'nsrc' bytes
+//
+// @return false if the data is corrupt
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+bool rans_decode_ptr_ptr(uint8_t *src, size_t nsrc, size_t nplanes, size_t plane_len, uint8_t *dst) {
+
+  uint8_t *ptr = src;
+  uint8_t *end = src + nsrc;
+
+  for (size_t k = 0; k < nplanes; k++) {
+    uint8_t *out = dst + k * plane_len;
+    if (ptr >= end) return false;
+
+    switch(*ptr++) {
+    case RANS_PLANE_RAW:
+      if ((size_t)(end - ptr) < plane_len) return false;
+      memcpy(out, ptr, plane_len);
+      ptr += plane_len;
+      break;
+    case RANS_PLANE_CONST:
+      if (ptr >= end) return false;
+      memset(out, *ptr++, plane_len);
+      break;
+    case RANS_PLANE_RANS: {
+      uint32_t freq[256];
+      if (!read_freqs(&ptr, end, freq)) return false;
+      if (end - ptr < 4) return false;
+      size_t clen = get_u32(ptr);
+      ptr += 4;
+      if ((size_t)(end - ptr) < clen) return false;
+      if (!decode_plane(ptr, clen, freq, out, plane_len)) return false;
+      ptr += clen;
+      break;
+    }
+    default:
+      return false;
+    }
+  }
+
+  return ptr == end;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Write the planes in 'src_buf' with 'write_buf()', coding them in 'tmp_buf'
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void write_planes(ctx_t *ctx, int src_buf, int tmp_buf, size_t nplanes, size_t plane_len) {
+  prepare_buf(ctx, tmp_buf, RANS_BOUND(nplanes, plane_len));
+  size_t nbytes = rans_encode_ptr_ptr(ctx->buf[src_buf], nplanes, plane_len, ctx->buf[tmp_buf]);
+  write_buf(ctx, tmp_buf, nbytes);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Decode planes written with 'write_planes()' into 'dst_buf'
+//
+// @param src,nsrc the payload. E.g. from 'borrow_buf()'
+// @return ctx->buf[dst_buf]
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+uint8_t *rans_decode_ptr_buf(ctx_t *ctx, uint8_t *src, size_t nsrc, int dst_buf,
+                             size_t nplanes, size_t plane_len) {
+  prepare_buf(ctx, dst_buf, nplanes * plane_len);
+  if (!rans_decode_ptr_ptr(src, nsrc, nplanes, plane_len, ctx->buf[dst_buf])) {
+    ctx_error(ctx, "rans_decode_ptr_buf(): Corrupt entropy coded data");
+  }
+  return ctx->buf[dst_buf];
+}
@@ -0,0 +1,40 @@
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Entropy coding of shuffled byte planes
+//
+// With option 'entropy', the shuffled payload of a double (or complex)
+// vector written with 'shuffle', 'delta_shuffle' or 'alp', or of an integer
+// vector written with 'zzshuf', is written as 'nplanes' byte planes, each
+// coded on its own with an order-0 rANS coder using its own statistics.
+// The method byte is flagged with ZAP_ENTROPY.
+//
+// Each plane is one of:
+//   [RANS_PLANE_RAW]   [plane_len bytes]
+//   [RANS_PLANE_CONST] [byte]
+//   [RANS_PLANE_RANS]  [present] [freqs] [clen] [clen bytes]
+//
+//   - present: 32 byte bitmap of the symbols which occur
+//   - freqs: for each symbol present, its frequency - 1 (out of
+//     RANS_SCALE) in 1 byte if < 128, otherwise 2 bytes with the high
+//     bit set on the first
+//   - clen: uint32_t. Coded bytes, including the 4 final rANS states
+//
+// Planes which wouldn't get smaller (e.g. the noisy low bytes of a double)
+// are detected from their histogram and stored raw without being coded.
+//
+// No R API calls. Safe to call from a worker thread.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#define ZAP_ENTROPY   0x20   // Flag on the method byte
+
+#define RANS_PLANE_RAW    0
+#define RANS_PLANE_CONST  1
+#define RANS_PLANE_RANS   2
+
+// Upper bound on the coded size of 'nplanes' planes of 'plane_len' bytes
+#define RANS_BOUND(nplanes, plane_len) ((nplanes) * ((plane_len) + 1024))
+
+size_t rans_encode_ptr_ptr(uint8_t *src, size_t nplanes, size_t plane_len, uint8_t *dst);
+bool   rans_decode_ptr_ptr(uint8_t *src, size_t nsrc, size_t nplanes, size_t plane_len, uint8_t *dst);
+
+void     write_planes(ctx_t *ctx, int src_buf, int tmp_buf, size_t nplanes, size_t plane_len);
+uint8_t *rans_decode_ptr_buf(ctx_t *ctx, uint8_t *src, size_t nsrc, int dst_buf,
+                             size_t nplanes, size_t plane_len);
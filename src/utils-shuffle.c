@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <stdbool.h>
 #include <unistd.h>
 
@@ -25,99 +26,443 @@
 // 
 // For the deluxe, full-strnegth implementation of this idea see BLOSC
 //   - https://www.blosc.org/pages/blosc-in-depth/
+//
+// 'n' elements of 'width' bytes are transposed into 'width' planes of 'n' 
+// bytes: plane 'k' holds byte 'k' of every element.
+//
+// The 'delta' variants then store the difference between each byte and
+// the one before it in the shuffled output (running on from the end of 
+// one plane to the start of the next).
+//
+// The elements are done in tiles of SHUFFLE_TILE bytes, so that the
+// source and destination of a tile stay in cache while each plane is 
+// visited in turn.  Otherwise each plane is a full pass over memory once
+// the vector is larger than the cache.  The delta chain of each plane runs
+// on from one tile to the next.
+//
+// On x86_64, whole blocks of 16 (SSE2) or 32 (AVX2) elements are 
+// transposed in registers, and the scalar code finishes the tail.  AVX2 is
+// used if the CPU supports it at run time.
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#if defined(__GNUC__) && defined(__x86_64__)
+#define SHUFFLE_X86
+#include <immintrin.h>
+#endif
 
+#define SHUFFLE_INLINE static inline __attribute__((always_inline))
+
+// Bytes of unshuffled data per tile. Tiles must be a multiple of 32 elements
+#define SHUFFLE_TILE 32768
 
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// Shuffle/Unshuffle bytes in a vector of doubles
+// The byte before element 'start' of plane 'k' in the shuffled output
+//
+// When unshuffling, 'dst' before 'start' is already decoded, and 'base[k]'
+// is the last byte of plane 'k - 1' (see plane_bases())
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-static void shuffle8(uint8_t *src, uint8_t *dst, size_t Ndbl) {
-  for (int ich = 0; ich < sizeof(double); ++ich) {
-    uint8_t *ptr = src + ich;
-    for (size_t ip = 0; ip < Ndbl; ++ip) {
-      *dst = *ptr;
-      ptr += sizeof(double);
-      dst += 1;
-    }
+SHUFFLE_INLINE uint8_t shuffle_prev(uint8_t *src, size_t n, size_t start, int width, int k) {
+  if (start > 0) {
+    return src[(start - 1) * width + k];
   }
+  return k > 0 ? src[(n - 1) * width + k - 1] : 0;
 }
 
 
-static void unshuffle8(uint8_t *src, uint8_t *dst, size_t Ndbl) {
-  for (int ich = 0; ich < sizeof(double); ++ich) {
-    uint8_t *dstPtr = dst + ich;
-    for (size_t ip = 0; ip < Ndbl; ++ip) {
-      *dstPtr = *src;
-      src += 1;
-      dstPtr += sizeof(double);
+SHUFFLE_INLINE uint8_t unshuffle_prev(uint8_t *dst, size_t start, int width, int k, uint8_t *base) {
+  return start > 0 ? dst[(start - 1) * width + k] : base[k];
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Sum of all bytes in a plane (mod 256)
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static uint8_t plane_sum(uint8_t *src, size_t n) {
+  uint64_t sum = 0;
+  size_t i = 0;
+#ifdef SHUFFLE_X86
+  __m128i zero = _mm_setzero_si128();
+  __m128i acc  = _mm_setzero_si128();
+  for (; i + 16 <= n; i += 16) {
+    acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((__m128i *)(src + i)), zero));
+  }
+  sum = (uint64_t)_mm_cvtsi128_si64(acc) + 
+    (uint64_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(acc, acc));
+#else
+  // 8 bytes at a time into 16-bit lanes, which can't overflow in 128 steps
+  const uint64_t mask = 0x00ff00ff00ff00ffULL;
+  while (i + 8 <= n) {
+    uint64_t acc = 0;
+    for (int j = 0; j < 128 && i + 8 <= n; j++, i += 8) {
+      uint64_t w;
+      memcpy(&w, src + i, sizeof(w));
+      acc += (w & mask) + ((w >> 8) & mask);
     }
+    sum += (acc & 0xffff) + ((acc >> 16) & 0xffff) + ((acc >> 32) & 0xffff) + (acc >> 48);
   }
+#endif
+  for (; i < n; i++) {
+    sum += src[i];
+  }
+  return (uint8_t)sum;
 }
 
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Decoded value of the last byte of each plane before it.  
+//
+// A delta-coded plane sums to its last value minus the last value of the 
+// plane before, so this lets the planes of a tile be decoded without the 
+// end of the previous plane
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-static void shuffle_delta8(uint8_t *src, uint8_t *dst, size_t n_dbls) {
-  uint8_t prev = 0;
-  for (int ich = 0; ich < sizeof(double); ++ich) {
-    uint8_t *ptr = src + ich;
-    for (size_t ip = 0; ip < n_dbls; ++ip) {
+static void plane_bases(uint8_t *src, size_t n, int width, uint8_t *base) {
+  base[0] = 0;
+  for (int k = 1; k < width; k++) {
+    base[k] = (uint8_t)(base[k - 1] + plane_sum(src + (k - 1) * n, n));
+  }
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Scalar kernels for elements [start, end)
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+SHUFFLE_INLINE void shuffle_scalar(uint8_t *src, uint8_t *dst, size_t n, 
+                                   size_t start, size_t end, int width, bool delta) {
+  if (start >= end) return;
+  
+  for (int ich = 0; ich < width; ++ich) {
+    uint8_t *ptr = src + start * width + ich;
+    uint8_t *dstPtr = dst + ich * n + start;
+    uint8_t prev = delta ? shuffle_prev(src, n, start, width, ich) : 0;
+    
+    for (size_t ip = start; ip < end; ++ip) {
       uint8_t v = *ptr;
-      *dst = v - prev;
+      *dstPtr = delta ? (uint8_t)(v - prev) : v;
       prev = v;
-      ptr += sizeof(double);  
-      dst += 1;
+      ptr += width;
+      dstPtr += 1;
     }
   }
 }
 
 
-static void unshuffle_delta8(uint8_t *src, uint8_t *dst, size_t n_dbls) {
-  uint8_t prev = 0;
-  for (int ich = 0; ich < sizeof(double); ++ich) {
-    uint8_t *dstPtr = dst + ich;
-    for (size_t ip = 0; ip < n_dbls; ++ip) {
-      uint8_t v = *src + prev;
+SHUFFLE_INLINE void unshuffle_scalar(uint8_t *src, uint8_t *dst, size_t n,
+                                     size_t start, size_t end, int width, bool delta,
+                                     uint8_t *base) {
+  if (start >= end) return;
+  
+  for (int ich = 0; ich < width; ++ich) {
+    uint8_t *srcPtr = src + ich * n + start;
+    uint8_t *dstPtr = dst + start * width + ich;
+    uint8_t prev = delta ? unshuffle_prev(dst, start, width, ich, base) : 0;
+    
+    for (size_t ip = start; ip < end; ++ip) {
+      uint8_t v = delta ? (uint8_t)(*srcPtr + prev) : *srcPtr;
       prev = v;
       *dstPtr = v;
-      src += 1;
-      dstPtr += sizeof(double);
+      srcPtr += 1;
+      dstPtr += width;
     }
   }
 }
 
 
 
+#ifdef SHUFFLE_X86
+
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Transpose in registers
+//
+// 'width' vectors hold 16 elements.  Byte 'p' of vector 'v' has index 
+// 'v * 16 + p', and a round of interleaving vectors 'v' and 
+// 'v + width/2' rotates the bits of this index left by 1.  
+//
+// Loaded from memory the index is 'element * width + byte'.  After 4 
+// rounds it is 'byte * 16 + element' i.e. each vector is a plane of 16 
+// bytes.  Unshuffling needs the rest of the full rotation: 3 rounds for 
+// 8-byte elements and 2 rounds for 4-byte elements.
+//
+// AVX2 interleaves within each 128-bit lane, so the lanes hold separate
+// blocks of 16 elements.
+//
+// The kernels do whole blocks from 'start' towards 'end' and return the
+// first element not done.
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-static void shuffle_delta4(uint8_t *src, uint8_t *dst, size_t n_ints) {
-  uint8_t prev = 0;
-  for (int ich = 0; ich < sizeof(uint32_t); ++ich) {
-    uint8_t *ptr = src + ich;
-    for (size_t ip = 0; ip < n_ints; ++ip) {
-      uint8_t v = *ptr;
-      *dst = v - prev;
-      prev = v;
-      ptr += sizeof(uint32_t);  
-      dst += 1;
+SHUFFLE_INLINE void transpose_sse2(__m128i *v, int width, int nrounds) {
+  __m128i t[8];
+  for (int r = 0; r < nrounds; r++) {
+    for (int i = 0; i < width / 2; i++) {
+      t[2 * i    ] = _mm_unpacklo_epi8(v[i], v[i + width / 2]);
+      t[2 * i + 1] = _mm_unpackhi_epi8(v[i], v[i + width / 2]);
+    }
+    for (int i = 0; i < width; i++) {
+      v[i] = t[i];
     }
   }
 }
 
 
-static void unshuffle_delta4(uint8_t *src, uint8_t *dst, size_t n_ints) {
-  uint8_t prev = 0;
-  for (int ich = 0; ich < sizeof(uint32_t); ++ich) {
-    uint8_t *dstPtr = dst + ich;
-    for (size_t ip = 0; ip < n_ints; ++ip) {
-      uint8_t v = *src + prev;
-      prev = v;
-      *dstPtr = v;
-      src += 1;
-      dstPtr += sizeof(uint32_t);
+SHUFFLE_INLINE size_t shuffle_sse2(uint8_t *src, uint8_t *dst, size_t n, 
+                                   size_t start, size_t end, int width, bool delta) {
+  // Byte 15 of 'prev[k]' is the byte before the next block of plane 'k'
+  __m128i v[8], prev[8];
+  if (delta) {
+    for (int k = 0; k < width; k++) {
+      prev[k] = _mm_set1_epi8((char)shuffle_prev(src, n, start, width, k));
+    }
+  }
+  
+  size_t i = start;
+  for (; i + 16 <= end; i += 16) {
+    for (int j = 0; j < width; j++) {
+      v[j] = _mm_loadu_si128((__m128i *)(src + i * width + 16 * j));
+    }
+    transpose_sse2(v, width, 4);
+    for (int k = 0; k < width; k++) {
+      __m128i x = v[k];
+      if (delta) {
+        __m128i before = _mm_or_si128(_mm_slli_si128(x, 1), _mm_srli_si128(prev[k], 15));
+        prev[k] = x;
+        x = _mm_sub_epi8(x, before);
+      }
+      _mm_storeu_si128((__m128i *)(dst + k * n + i), x);
+    }
+  }
+  
+  return i;
+}
+
+
+SHUFFLE_INLINE size_t unshuffle_sse2(uint8_t *src, uint8_t *dst, size_t n, 
+                                     size_t start, size_t end, int width, bool delta,
+                                     uint8_t *base) {
+  // 'carry[k]' is the last decoded byte of plane 'k' in every position
+  __m128i v[8], carry[8];
+  if (delta) {
+    for (int k = 0; k < width; k++) {
+      carry[k] = _mm_set1_epi8((char)unshuffle_prev(dst, start, width, k, base));
+    }
+  }
+  
+  size_t i = start;
+  for (; i + 16 <= end; i += 16) {
+    for (int k = 0; k < width; k++) {
+      __m128i x = _mm_loadu_si128((__m128i *)(src + k * n + i));
+      if (delta) {
+        // Prefix sum
+        x = _mm_add_epi8(x, _mm_slli_si128(x, 1));
+        x = _mm_add_epi8(x, _mm_slli_si128(x, 2));
+        x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+        x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+        x = _mm_add_epi8(x, carry[k]);
+        // Broadcast byte 15
+        __m128i t = _mm_unpackhi_epi8(x, x);
+        t = _mm_unpackhi_epi16(t, t);
+        carry[k] = _mm_shuffle_epi32(t, 0xff);
+      }
+      v[k] = x;
+    }
+    transpose_sse2(v, width, width == 8 ? 3 : 2);
+    for (int j = 0; j < width; j++) {
+      _mm_storeu_si128((__m128i *)(dst + i * width + 16 * j), v[j]);
+    }
+  }
+  
+  return i;
+}
+
+
+#define AVX2_INLINE static inline __attribute__((always_inline, target("avx2")))
+
+AVX2_INLINE void transpose_avx2(__m256i *v, int width, int nrounds) {
+  __m256i t[8];
+  for (int r = 0; r < nrounds; r++) {
+    for (int i = 0; i < width / 2; i++) {
+      t[2 * i    ] = _mm256_unpacklo_epi8(v[i], v[i + width / 2]);
+      t[2 * i + 1] = _mm256_unpackhi_epi8(v[i], v[i + width / 2]);
+    }
+    for (int i = 0; i < width; i++) {
+      v[i] = t[i];
+    }
+  }
+}
+
+
+AVX2_INLINE size_t shuffle_avx2(uint8_t *src, uint8_t *dst, size_t n, 
+                                size_t start, size_t end, int width, bool delta) {
+  // Byte 31 of 'prev[k]' is the byte before the next block of plane 'k'
+  __m256i v[8], prev[8];
+  if (delta) {
+    for (int k = 0; k < width; k++) {
+      prev[k] = _mm256_set1_epi8((char)shuffle_prev(src, n, start, width, k));
+    }
+  }
+  
+  size_t i = start;
+  for (; i + 32 <= end; i += 32) {
+    // Lane 1 holds the second 16 elements
+    uint8_t *ptr = src + i * width;
+    for (int j = 0; j < width; j++) {
+      __m128i lo = _mm_loadu_si128((__m128i *)(ptr + 16 * j));
+      __m128i hi = _mm_loadu_si128((__m128i *)(ptr + 16 * width + 16 * j));
+      v[j] = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+    }
+    transpose_avx2(v, width, 4);
+    for (int k = 0; k < width; k++) {
+      __m256i x = v[k];
+      if (delta) {
+        __m256i t = _mm256_permute2x128_si256(prev[k], x, 0x21);
+        __m256i before = _mm256_alignr_epi8(x, t, 15);
+        prev[k] = x;
+        x = _mm256_sub_epi8(x, before);
+      }
+      _mm256_storeu_si256((__m256i *)(dst + k * n + i), x);
     }
   }
+  
+  return i;
+}
+
+
+AVX2_INLINE size_t unshuffle_avx2(uint8_t *src, uint8_t *dst, size_t n, 
+                                  size_t start, size_t end, int width, bool delta,
+                                  uint8_t *base) {
+  // 'carry[k]' is the last decoded byte of plane 'k' in every position
+  __m256i v[8], carry[8];
+  __m256i last = _mm256_set1_epi8(15);
+  if (delta) {
+    for (int k = 0; k < width; k++) {
+      carry[k] = _mm256_set1_epi8((char)unshuffle_prev(dst, start, width, k, base));
+    }
+  }
+  
+  size_t i = start;
+  for (; i + 32 <= end; i += 32) {
+    for (int k = 0; k < width; k++) {
+      __m256i x = _mm256_loadu_si256((__m256i *)(src + k * n + i));
+      if (delta) {
+        // Prefix sum within each lane, then carry lane 0 into lane 1
+        x = _mm256_add_epi8(x, _mm256_slli_si256(x, 1));
+        x = _mm256_add_epi8(x, _mm256_slli_si256(x, 2));
+        x = _mm256_add_epi8(x, _mm256_slli_si256(x, 4));
+        x = _mm256_add_epi8(x, _mm256_slli_si256(x, 8));
+        __m256i b = _mm256_shuffle_epi8(x, last);
+        x = _mm256_add_epi8(x, _mm256_permute2x128_si256(b, b, 0x08));
+        x = _mm256_add_epi8(x, carry[k]);
+        b = _mm256_shuffle_epi8(x, last);
+        carry[k] = _mm256_permute2x128_si256(b, b, 0x11);
+      }
+      v[k] = x;
+    }
+    transpose_avx2(v, width, width == 8 ? 3 : 2);
+    uint8_t *ptr = dst + i * width;
+    for (int j = 0; j < width; j++) {
+      _mm_storeu_si128((__m128i *)(ptr + 16 * j), _mm256_castsi256_si128(v[j]));
+      _mm_storeu_si128((__m128i *)(ptr + 16 * width + 16 * j), _mm256_extracti128_si256(v[j], 1));
+    }
+  }
+  
+  return i;
+}
+
+// Separate functions so that only these are compiled for AVX2
+#define AVX2_FUNC static __attribute__((noinline, target("avx2"))) size_t
+#define ARGS      uint8_t *src, uint8_t *dst, size_t n, size_t start, size_t end
+
+AVX2_FUNC shuffle8_avx2        (ARGS)                { return   shuffle_avx2(src, dst, n, start, end, 8, false); }
+AVX2_FUNC unshuffle8_avx2      (ARGS, uint8_t *base) { return unshuffle_avx2(src, dst, n, start, end, 8, false, base); }
+AVX2_FUNC shuffle_delta8_avx2  (ARGS)                { return   shuffle_avx2(src, dst, n, start, end, 8, true ); }
+AVX2_FUNC unshuffle_delta8_avx2(ARGS, uint8_t *base) { return unshuffle_avx2(src, dst, n, start, end, 8, true , base); }
+AVX2_FUNC shuffle_delta4_avx2  (ARGS)                { return   shuffle_avx2(src, dst, n, start, end, 4, true ); }
+AVX2_FUNC unshuffle_delta4_avx2(ARGS, uint8_t *base) { return unshuffle_avx2(src, dst, n, start, end, 4, true , base); }
+
+#undef ARGS
+
+
+static bool has_avx2(void) {
+  // Called from worker threads.  Every thread computes the same value, so
+  // relaxed atomics are enough to make the cache race-free
+  static int avx2 = -1;
+  int val = __atomic_load_n(&avx2, __ATOMIC_RELAXED);
+  if (val < 0) {
+    __builtin_cpu_init();
+    val = __builtin_cpu_supports("avx2") ? 1 : 0;
+    __atomic_store_n(&avx2, val, __ATOMIC_RELAXED);
+  }
+  return val;
+}
+
+#define   SHUFFLE_SIMD(fn, src, dst, n, start, end, width, delta)                   \
+  (has_avx2() ? fn##_avx2(src, dst, n, start, end) :                                \
+                  shuffle_sse2(src, dst, n, start, end, width, delta))
+#define UNSHUFFLE_SIMD(fn, src, dst, n, start, end, width, delta, base)             \
+  (has_avx2() ? fn##_avx2(src, dst, n, start, end, base) :                          \
+                unshuffle_sse2(src, dst, n, start, end, width, delta, base))
+
+#else
+
+#define   SHUFFLE_SIMD(fn, src, dst, n, start, end, width, delta)       (start)
+#define UNSHUFFLE_SIMD(fn, src, dst, n, start, end, width, delta, base) (start)
+
+#endif
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Do each tile with SIMD, then scalar code for the tail.  The SIMD step
+// returns the first element of the tile it did not do
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#define SHUFFLE_TILED(fn, src, dst, n, width, delta)                               \
+  for (size_t start = 0; start < n; start += SHUFFLE_TILE / width) {               \
+    size_t end  = start + SHUFFLE_TILE / width < n ? start + SHUFFLE_TILE / width : n; \
+    size_t done = SHUFFLE_SIMD(fn, src, dst, n, start, end, width, delta);         \
+    shuffle_scalar(src, dst, n, done, end, width, delta);                          \
+  }
+
+#define UNSHUFFLE_TILED(fn, src, dst, n, width, delta)                             \
+  uint8_t base[8] = {0};                                                           \
+  if (delta) plane_bases(src, n, width, base);                                     \
+  for (size_t start = 0; start < n; start += SHUFFLE_TILE / width) {               \
+    size_t end  = start + SHUFFLE_TILE / width < n ? start + SHUFFLE_TILE / width : n; \
+    size_t done = UNSHUFFLE_SIMD(fn, src, dst, n, start, end, width, delta, base); \
+    unshuffle_scalar(src, dst, n, done, end, width, delta, base);                  \
+  }
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Shuffle/Unshuffle bytes in a vector of doubles
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void shuffle8(uint8_t *src, uint8_t *dst, size_t Ndbl) {
+  SHUFFLE_TILED(shuffle8, src, dst, Ndbl, 8, false);
+}
+
+
+static void unshuffle8(uint8_t *src, uint8_t *dst, size_t Ndbl) {
+  UNSHUFFLE_TILED(unshuffle8, src, dst, Ndbl, 8, false);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void shuffle_delta8(uint8_t *src, uint8_t *dst, size_t n_dbls) {
+  SHUFFLE_TILED(shuffle_delta8, src, dst, n_dbls, 8, true);
+}
+
+
+static void unshuffle_delta8(uint8_t *src, uint8_t *dst, size_t n_dbls) {
+  UNSHUFFLE_TILED(unshuffle_delta8, src, dst, n_dbls, 8, true);
+}
+
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void shuffle_delta4(uint8_t *src, uint8_t *dst, size_t n_ints) {
+  SHUFFLE_TILED(shuffle_delta4, src, dst, n_ints, 4, true);
+}
+
+
+static void unshuffle_delta4(uint8_t *src, uint8_t *dst, size_t n_ints) {
+  UNSHUFFLE_TILED(unshuffle_delta4, src, dst, n_ints, 4, true);
 }
 
 
@@ -152,6 +497,10 @@ void unshuffle8_buf_ptr(ctx_t *ctx, int src_buf, void *dst, size_t n_dbls) {
   unshuffle8(ctx->buf[src_buf], dst, n_dbls);
 }
 
+void unshuffle8_ptr_ptr(ctx_t *ctx, void *src, void *dst, size_t n_dbls) {
+  unshuffle8(src, dst, n_dbls);
+}
+
 
 
 
@@ -186,6 +535,15 @@ void unshuffle_delta8_buf_ptr(ctx_t *ctx, int src_buf, void *dst, size_t n_dbls)
   unshuffle_delta8(ctx->buf[src_buf], dst, n_dbls);
 }
 
+void unshuffle_delta8_ptr_buf(ctx_t *ctx, void *src, int dst_buf, size_t n_dbls) {
+  prepare_buf(ctx, dst_buf, n_dbls * sizeof(double));
+  unshuffle_delta8(src, ctx->buf[dst_buf], n_dbls);
+}
+
+void unshuffle_delta8_ptr_ptr(ctx_t *ctx, void *src, void *dst, size_t n_dbls) {
+  unshuffle_delta8(src, dst, n_dbls);
+}
+
 
 
 
@@ -219,4 +577,9 @@ void unshuffle_delta4_buf_ptr(ctx_t *ctx, int src_buf, void *dst, size_t n_ints)
   unshuffle_delta4(ctx->buf[src_buf], dst, n_ints);
 }
 
+void unshuffle_delta4_ptr_buf(ctx_t *ctx, void *src, int dst_buf, size_t n_ints) {
+  prepare_buf(ctx, dst_buf, n_ints * sizeof(uint32_t));
+  unshuffle_delta4(src, ctx->buf[dst_buf], n_ints);
+}
+
 
@@ -36,80 +36,36 @@
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 void write_len(ctx_t *ctx, uint64_t val) {
   
-  if (val < (1ULL << 7)) {
-    write_uint8(ctx, ((uint8_t)(val >>  0) & 0x7f)      );
-  } else if (val < (1ULL << ( 2 * 7))) {
-    write_uint8(ctx, ((uint8_t)(val >>  0) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >>  7) & 0x7f)      );
-  } else if (val < (1ULL << (3 * 7))) {
-    write_uint8(ctx, ((uint8_t)(val >>  0) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >>  7) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 14) & 0x7f)      );
-  } else if (val < (1ULL << (4 * 7))) {
-    write_uint8(ctx, ((uint8_t)(val >>  0) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >>  7) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 14) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 21) & 0x7f)      );
-  } else if (val < (1ULL << (5 * 7))) {
-    write_uint8(ctx, ((uint8_t)(val >>  0) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >>  7) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 14) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 21) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 28) & 0x7f)      );
-  } else if (val < (1ULL << (6 * 7))) {
-    write_uint8(ctx, ((uint8_t)(val >>  0) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >>  7) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 14) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 21) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 28) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 35) & 0x7f)      );
-  } else if (val < (1ULL << (7 * 7))) {
-    write_uint8(ctx, ((uint8_t)(val >>  0) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >>  7) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 14) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 21) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 28) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 35) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 42) & 0x7f)      );
-  } else if (val < (1ULL << (8 * 7))) {
-    write_uint8(ctx, ((uint8_t)(val >>  0) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >>  7) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 14) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 21) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 28) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 35) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 42) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 49) & 0x7f)      );
-  } else if (val < (1ULL << (9 * 7))) {
-    write_uint8(ctx, ((uint8_t)(val >>  0) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >>  7) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 14) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 21) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 28) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 35) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 42) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 49) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 56) & 0x7f)      );
-  } else {
-    write_uint8(ctx, ((uint8_t)(val >>  0) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >>  7) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 14) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 21) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 28) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 35) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 42) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 49) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 56) & 0x7f) | MSB);
-    write_uint8(ctx, ((uint8_t)(val >> 63) & 0x7f)      );
+  // Most lengths are small and fit in a single byte
+  if (val < MSB) {
+    put_u8(ctx, (uint8_t)val);
+    return;
   }
   
+  // Encode directly into the stage if there is room, otherwise into a
+  // local array. Either way, the bytes are emitted with a single write.
+  uint8_t tmp[10];
+  uint8_t *start = ((size_t)(ctx->wend - ctx->wptr) >= sizeof(tmp)) ? ctx->wptr : tmp;
+  uint8_t *p = start;
+  
+  while (val >= MSB) {
+    *p++ = (uint8_t)(val | MSB);
+    val >>= 7;
+  }
+  *p++ = (uint8_t)val;
+  
+  if (start == ctx->wptr) {
+    ctx->wptr = p;
+  } else {
+    ctx_write(ctx, tmp, (size_t)(p - tmp));
+  }
 }
 
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// 
+// Slow path. One byte at a time
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-uint64_t read_len(ctx_t *ctx) {
+static uint64_t read_len_slow(ctx_t *ctx) {
   
   uint64_t val = 0;
   uint8_t b = 0;
@@ -124,6 +80,38 @@ uint64_t read_len(ctx_t *ctx) {
 }
 
 
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// If the read window holds at least 10 bytes (the longest possible varint)
+// then decode directly from memory with a single bounds check.
+// The continuation bit is added in with the byte and then subtracted again 
+// if decoding continues.  This keeps the dependency chain short.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+uint64_t read_len(ctx_t *ctx) {
+  
+  if ((size_t)(ctx->rend - ctx->rptr) < 10) {
+    return read_len_slow(ctx);
+  }
+  
+  const uint8_t *p = ctx->rptr;
+  uint64_t b, val;
+  
+  b = *p++; val  = b      ; if (b < MSB) goto done; val -= (uint64_t)MSB      ;
+  b = *p++; val += b <<  7; if (b < MSB) goto done; val -= (uint64_t)MSB <<  7;
+  b = *p++; val += b << 14; if (b < MSB) goto done; val -= (uint64_t)MSB << 14;
+  b = *p++; val += b << 21; if (b < MSB) goto done; val -= (uint64_t)MSB << 21;
+  b = *p++; val += b << 28; if (b < MSB) goto done; val -= (uint64_t)MSB << 28;
+  b = *p++; val += b << 35; if (b < MSB) goto done; val -= (uint64_t)MSB << 35;
+  b = *p++; val += b << 42; if (b < MSB) goto done; val -= (uint64_t)MSB << 42;
+  b = *p++; val += b << 49; if (b < MSB) goto done; val -= (uint64_t)MSB << 49;
+  b = *p++; val += b << 56; if (b < MSB) goto done; val -= (uint64_t)MSB << 56;
+  b = *p++; val += b << 63;
+  
+done:
+  ctx->rptr = (uint8_t *)p;
+  return val;
+}
+
+
 
 
 
@@ -13,8 +13,14 @@
 
 #include "io-ctx.h"
 #include "io-core.h"
+#include "io-frame.h"
+#include "io-plan.h"
+#include "io-decode.h"
+#include "io-index.h"
+#include "io-chunk.h"
 
 #include "utils-df.h"
+#include "utils-altrep-raw.h"
 
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -42,6 +48,11 @@ typedef struct {
 //   - flag1 bit0 is used to indicate if the encoded stream uses VECSXP 
 //     references
 //   - flag2 is unused.
+// Version 3
+//   - flag2 bit0 indicates the stream is framed. See 'io-frame.h'
+// Versions 4 to 7
+//   - the header is unchanged. See 'io-ctx.h' for what changed in the 
+//     stream itself
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 #define HEADER_LEN 4
 
@@ -99,17 +110,108 @@ void read_raw_buffer(void *user_data, void *buf, size_t len) {
 
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// Write an object to a raw vector
-// - parse any options from the user
-// - create a raw_buffer_t buffer
+// Write an object to a sink
+// - write the 4-byte header
 // - create a serialization context, specifying:
-//      - buffer to passed to the callback
-//      - the actual callbak function
+//      - the sink to be passed to the callback
+//      - the callback which writes to the sink
 //      - the options
 // - serialize the object by calling 'write_sexp()'
-// - convert the data in 'raw_buffer_t *buffer' to an R raw vector
-// - insert the 2-byte header
-// - return raw vector to R
+// - append the index after the end of the stream. See 'io-index.h'
+//
+// If framing, the frame writer sits between the context and the sink.
+// With multiple threads, a plan sits in front of that. See 'io-plan.h'
+// Neither is used when tallying objects, as the tally records 
+// positions in the uncompressed stream as it is written.
+//
+// Used by 'write_zap_()', 'write_zap_con_()' (see 'zap-file.c') and 
+// 'write_zap_shm_()' (see 'zap-shm.c')
+//
+// @return the context. The caller must free it with 'ctx_destroy()'
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ctx_t *write_zap_sink(SEXP obj_, void *sink, 
+                      void (*sink_write)(void *user_data, void *buf, size_t len), 
+                      opts_t *opts) {
+  bool objdf  = opts->verbosity & ZAP_VERBOSITY_OBJDF;
+  bool framed = opts->frame == ZAP_FRAME_ON && !objdf;
+  bool index  = opts->index && !objdf;
+  
+  //---------------------------------------------------------------------------
+  // - write the 4-byte header
+  //---------------------------------------------------------------------------
+  uint8_t header[HEADER_LEN];
+  header[0] = 'Z' | 0x80;
+  header[1] = ZAP_VERSION;  
+  header[2] = opts->vec_transform == ZAP_VEC_REF;  // lowest bit indicates if list references are used
+  header[3] = framed ? FLAG2_FRAMED : 0x00;
+  if (index) header[3] |= FLAG2_INDEX;
+  sink_write(sink, header, HEADER_LEN);
+  
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // - create a serialization context
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  void *user_data = sink;
+  void (*write)(void *user_data, void *buf, size_t len) = sink_write;
+  
+  frame_writer_t *fw = NULL;
+  if (framed) {
+    fw        = frame_writer_create(user_data, write, opts);
+    PROTECT(fw->guard_);
+    user_data = fw;
+    write     = frame_write;
+  }
+  
+  plan_t *plan = NULL;
+  if (opts->nthreads > 1 && !objdf) {
+    plan      = plan_create(user_data, write, opts);
+    user_data = plan;
+    write     = plan_write;
+  }
+  
+  ctx_t *ctx = create_serialize_ctx(user_data, write, opts);
+  ctx->plan  = plan;
+  
+  if (index) {
+    ctx->index = index_create();
+    if (plan != NULL) plan->index = ctx->index;
+  }
+  
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // - serialize the object by calling 'write_sexp()'
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  int64_t root = ctx->index != NULL ? index_begin(ctx, -1, NA_STRING, obj_) : -1;
+  write_sexp(ctx, obj_);
+  if (root >= 0) index_end(ctx, root);
+  ctx_flush(ctx);
+  if (plan != NULL) {
+    plan_run(plan);
+    plan_destroy(plan);
+  }
+  if (fw != NULL) {
+    frame_writer_finish(fw);
+  }
+  
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // - append the index after the end of the stream. See 'io-index.h'
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  if (ctx->index != NULL) {
+    write_index(ctx->index, fw, sink, sink_write);
+  }
+  if (fw != NULL) {
+    frame_writer_destroy(fw);
+    UNPROTECT(1);
+  }
+  
+  return ctx;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Write an object to a raw vector
+// - parse any options from the user
+// - create a raw_buffer_t buffer
+// - write the object to the buffer with 'write_zap_sink()'
+// - wrap the buffer as an ALTREP raw vector (no copy) and return it to R
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 SEXP write_zap_(SEXP obj_, SEXP dst_, SEXP opts_) {
   int nprotect = 0;
@@ -133,78 +235,103 @@ SEXP write_zap_(SEXP obj_, SEXP dst_, SEXP opts_) {
   }
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  // - create a serialization context, specifying:
-  //      - buffer to passed to the callback
-  //      - the actual callbak function
-  //      - the options
-  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  ctx_t *ctx = create_serialize_ctx(buffer,
-                                    write_raw_buffer,
-                                    opts);
-  
-  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  // - serialize the object by calling 'write_sexp()'
+  // - write the object to the buffer
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  write_sexp(ctx, obj_);
-  
-  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  // - convert the data in 'raw_buffer_t *buffer' to an R raw vector
-  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  SEXP res_ = R_NilValue;
-  res_ = PROTECT(Rf_allocVector(RAWSXP, (R_xlen_t)(buffer->pos + HEADER_LEN))); nprotect++;
-  memcpy(RAW(res_) + HEADER_LEN, buffer->data, buffer->pos);
-  
-  //---------------------------------------------------------------------------
-  // - insert the 2-byte header at the start of the raw data
-  //---------------------------------------------------------------------------
-  uint8_t *p = (uint8_t *)RAW(res_);
-  p[0] = 'Z' | 0x80;
-  p[1] = ZAP_VERSION;  
-  p[2] = opts->vec_transform == ZAP_VEC_REF;  // lowest bit indicates if list references are used
-  p[3] = 0x00; // Unused
+  ctx_t *ctx = write_zap_sink(obj_, buffer, write_raw_buffer, opts);
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // - If (verbosity & ZAP_VERBOSITY_OBJEDF) then return the tally structure, not the data!
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  SEXP res_ = R_NilValue;
   if (ctx->opts->verbosity & ZAP_VERBOSITY_OBJDF) {
     res_ = PROTECT(VECTOR_ELT(ctx->cache, ZAP_CACHE_TALLY)); nprotect++;
     df_truncate(res_, (int)ctx->obj_count);
     set_df_attributes(res_);
+    free(buffer->data);
+    buffer->data = NULL;
   }
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // - tidy memory
-  // - return result to R
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   ctx_destroy(ctx);
-  free(buffer->data);
-  free(buffer);
   free(opts);
+  
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // - hand the buffer to R as an ALTREP raw vector. No copy is made.
+  //   Any slack from the doubling growth strategy is released first.
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  if (buffer->data != NULL) {
+    uint8_t *data = buffer->data;
+    size_t len = buffer->pos;
+    free(buffer);
+    
+    uint8_t *shrunk = realloc(data, len);
+    if (shrunk != NULL) data = shrunk;
+    
+    res_ = PROTECT(wrap_raw_buffer(data, len)); nprotect++;
+  } else {
+    free(buffer);
+  }
+  
   UNPROTECT(nprotect);
   return res_;
 }
 
 
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Position within the serialized stream (not counting the header).
+// Used when tallying objects for 'ZAP_VERBOSITY_OBJDF'
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 size_t get_position(void *user_data) {
   raw_buffer_t *buffer = (raw_buffer_t *)user_data;
-  return buffer->pos;
+  return buffer->pos - HEADER_LEN;
 }
 
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// Unserialize an object from a raw vector
+// Unpack a framed stream into a buffer owned by an external pointer, so 
+// the buffer is freed by the finalizer if reading it raises an R error.
+// The caller must PROTECT '*guard_' and call 'unpacked_release()' when done
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void unpacked_release(SEXP guard_) {
+  free(R_ExternalPtrAddr(guard_));
+  R_ClearExternalPtr(guard_);
+}
+
+static uint8_t *unpack_guarded(uint8_t *src, size_t src_len, size_t *len, 
+                               int nthreads, SEXP *guard_) {
+  *guard_ = PROTECT(R_MakeExternalPtr(NULL, R_NilValue, R_NilValue));
+  R_RegisterCFinalizerEx(*guard_, unpacked_release, TRUE);
+  uint8_t *unpacked = frame_unpack(src, src_len, len, nthreads);
+  R_SetExternalPtrAddr(*guard_, unpacked);
+  UNPROTECT(1);
+  return unpacked;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Unserialize an object from memory e.g. the data of a raw vector, or a 
+// mapping of shared memory (see 'zap-shm.c').  The memory is only read.
 //
 // - parse any user options
 // - Check header is valid.
-// - Create 'raw_buffer_t *' which points to the data in the given raw vector
+// - Create 'raw_buffer_t *' which points to the data
 // - Create a context for the unserialization
 //    - user_data which will get passed to the callback
 //    - the callback used by 'read_sexp()' to fetch bytes
 //    - user options
+// - Give the context direct access to the data for fast reads
 // - Unserialize data to an R object
 // - Tidy memory and return unserialized object
+//
+// @param src the stream, starting with the 4-byte header
+// @param len number of bytes at 'src'
+// @param map_ if 'src' is a mapped file, the external pointer which owns
+//        the mapping, so aligned vectors can be backed by it. See 
+//        'zap-mmap.c'.  Otherwise R_NilValue
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-SEXP read_zap_(SEXP src_, SEXP opts_) {
+SEXP read_zap_mem(uint8_t *src, size_t len, SEXP opts_, SEXP map_) {
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // - parse any user options
@@ -214,11 +341,11 @@ SEXP read_zap_(SEXP src_, SEXP opts_) {
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // - Check header is valid.
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  uint8_t *p = (uint8_t *)RAW(src_);
-  if (p[0] != ('Z' | 0x80)) {
+  uint8_t *p = src;
+  if (len < HEADER_LEN || p[0] != ('Z' | 0x80)) {
     Rf_error("unzap_raw(): Does not appear to be 'zap', serialized data");
   }
-  if (p[1] != ZAP_VERSION) {
+  if (p[1] > ZAP_VERSION) {
     Rf_warning("read_zap_(): Version numbers to not match. Expecting %i, Found %i\nAttempting to continue ... ", 
              ZAP_VERSION, p[1]);
   }
@@ -233,8 +360,24 @@ SEXP read_zap_(SEXP src_, SEXP opts_) {
   if (buffer == NULL) Rf_error("unzap_raw(): buffer malloc failed");
   
   buffer->pos = 0;
-  buffer->capacity = (size_t)Rf_length(src_) - HEADER_LEN;
-  buffer->data = RAW(src_) + HEADER_LEN;
+  buffer->capacity = len - HEADER_LEN;
+  buffer->data = src + HEADER_LEN;
+  
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // - If the stream is framed, decompress all blocks up-front so that
+  //   the context can still read directly from memory.
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  int nprotect = 0;
+  SEXP unpacked_ = R_NilValue;
+  uint8_t *unpacked = NULL;
+  if (p[3] & FLAG2_FRAMED) {
+    size_t len = 0;
+    unpacked = unpack_guarded(buffer->data, buffer->capacity, &len, 
+                              opts->nthreads, &unpacked_);
+    PROTECT(unpacked_); nprotect++;
+    buffer->data = unpacked;
+    buffer->capacity = len;
+  }
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // - Create a context for the unserialization
@@ -246,18 +389,153 @@ SEXP read_zap_(SEXP src_, SEXP opts_) {
                                       read_raw_buffer,
                                       opts);
   
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // - Give the context direct access to the data.
+  //   The caller keeps the data valid for the duration of this call so it 
+  //   is safe for decoders to borrow pointers into it.
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  ctx_set_read_window(ctx, buffer->data, buffer->capacity);
+  buffer->pos = buffer->capacity;
+  
+  // Framed streams were unpacked to a copy, so can't be backed by the mapping
+  if (map_ != R_NilValue && unpacked == NULL) {
+    ctx->map = map_;
+  }
+  
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // - With multiple threads, vectors are allocated as the stream is read
+  //   but their data is decoded in parallel afterwards. See 'io-decode.h'
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  decoder_t *decoder = NULL;
+  if (opts->nthreads > 1) {
+    decoder = decoder_create(opts);
+    PROTECT(decoder->guard_); nprotect++;
+    ctx->decoder = decoder;
+  }
+  
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // - Unserialize data to an R object
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-  SEXP res_ = PROTECT(read_sexp(ctx));
+  SEXP res_ = PROTECT(read_sexp(ctx)); nprotect++;
+  if (decoder != NULL) {
+    decoder_run(decoder);
+    decoder_destroy(decoder);
+  }
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // - Tidy memory and return unserialized object
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   ctx_destroy(ctx);
+  if (unpacked != NULL) unpacked_release(unpacked_);
   free(buffer);
   free(opts);
-  UNPROTECT(1);
+  UNPROTECT(nprotect);
+  return res_;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Unserialize an object from a raw vector
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+SEXP read_zap_(SEXP src_, SEXP opts_) {
+  return read_zap_mem(RAW(src_), (size_t)Rf_xlength(src_), opts_, R_NilValue);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Read a single index entry.  See 'io-index.h'
+//
+// @param data,len the bytes holding the entry. If framed, this is a run
+//        of whole blocks followed by an end-of-stream block
+// @param at_ list of
+//        offset   position of the entry in 'data' (after unpacking)
+//        framed   is 'data' framed?
+//        vec_ref  are list references used?
+//        env_base, vec_base  cache sizes at the start of the entry
+//        attrs    is the entry the attributes of a list? If so, these are
+//                 returned as the attributes of an empty list
+//        chunk    is the entry a chunk of a vector? See 'io-chunk.h'
+// @param opts_ user options
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+SEXP read_zap_at(uint8_t *data, size_t len, SEXP at_, SEXP opts_) {
+  
+  if (TYPEOF(at_) != VECSXP || Rf_length(at_) != 7) {
+    Rf_error("read_zap_at(): Bad arguments");
+  }
+  
+  size_t   offset   = (size_t)Rf_asReal(VECTOR_ELT(at_, 0));
+  bool     framed   = Rf_asLogical(VECTOR_ELT(at_, 1)) == TRUE;
+  bool     vec_ref  = Rf_asLogical(VECTOR_ELT(at_, 2)) == TRUE;
+  R_xlen_t env_base = (R_xlen_t)Rf_asReal(VECTOR_ELT(at_, 3));
+  R_xlen_t vec_base = (R_xlen_t)Rf_asReal(VECTOR_ELT(at_, 4));
+  bool     attrs    = Rf_asLogical(VECTOR_ELT(at_, 5)) == TRUE;
+  bool     chunk    = Rf_asLogical(VECTOR_ELT(at_, 6)) == TRUE;
+  
+  opts_t *opts = parse_options(opts_);
+  if (vec_ref) {
+    opts->vec_transform = ZAP_VEC_REF;
+  }
+  
+  int nprotect = 0;
+  SEXP unpacked_ = R_NilValue;
+  uint8_t *unpacked = NULL;
+  if (framed) {
+    unpacked = unpack_guarded(data, len, &len, opts->nthreads, &unpacked_);
+    PROTECT(unpacked_); nprotect++;
+    data = unpacked;
+  }
+  
+  if (offset > len) {
+    free(opts);
+    Rf_error("read_zap_at(): Offset beyond end of data");
+  }
+  
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // The context reads directly from memory. No callback is needed as 
+  // reading past the window is an error
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  raw_buffer_t buffer = { .data = data + offset, .pos = len - offset, .capacity = len - offset };
+  ctx_t *ctx = create_unserialize_ctx(&buffer, read_raw_buffer, opts);
+  ctx_set_read_window(ctx, data + offset, len - offset);
+  index_prepare_read(ctx, env_base, vec_base);
+  
+  decoder_t *decoder = NULL;
+  if (opts->nthreads > 1) {
+    decoder = decoder_create(opts);
+    PROTECT(decoder->guard_); nprotect++;
+    ctx->decoder = decoder;
+  }
+  
+  SEXP res_ = R_NilValue;
+  if (attrs) {
+    res_ = PROTECT(Rf_allocVector(VECSXP, 0)); nprotect++;
+    read_attrs(ctx, res_);
+  } else if (chunk) {
+    res_ = PROTECT(read_chunk(ctx)); nprotect++;
+  } else {
+    res_ = PROTECT(read_sexp(ctx)); nprotect++;
+  }
+  if (decoder != NULL) {
+    decoder_run(decoder);
+    decoder_destroy(decoder);
+  }
+  
+  ctx_destroy(ctx);
+  if (unpacked != NULL) unpacked_release(unpacked_);
+  free(opts);
+  UNPROTECT(nprotect);
   return res_;
 }
 
+
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Read a single index entry from a raw vector. See 'read_zap_at()'
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+SEXP read_zap_at_(SEXP src_, SEXP at_, SEXP opts_) {
+  if (TYPEOF(src_) != RAWSXP) {
+    Rf_error("read_zap_at_(): 'src' must be a raw vector");
+  }
+  return read_zap_at(RAW(src_), (size_t)Rf_xlength(src_), at_, opts_);
+}
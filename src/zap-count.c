@@ -73,6 +73,7 @@ SEXP zap_count_(SEXP obj_, SEXP opts_) {
   // - serialize the object by calling 'write_sexp()'
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   write_sexp(ctx, obj_);
+  ctx_flush(ctx);
   
   //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   // - count the bytes
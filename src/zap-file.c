@@ -0,0 +1,261 @@
+
+#define R_NO_REMAP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include <R.h>
+#include <Rinternals.h>
+#include <Rdefines.h>
+#include <R_ext/Connections.h>
+
+#if ! defined(R_CONNECTIONS_VERSION) || R_CONNECTIONS_VERSION != 1
+#error "Unsupported connections API version"
+#endif
+
+#include "io-ctx.h"
+#include "io-core.h"
+#include "io-frame.h"
+
+// from zap-core.c
+extern ctx_t *write_zap_sink(SEXP obj_, void *sink,
+                             void (*sink_write)(void *user_data, void *buf, size_t len),
+                             opts_t *opts);
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Streaming to/from R connections
+//
+// The connection is opened on the R side (e.g. 'gzfile()', 'xzfile()') so
+// compression happens in a streaming fashion as each chunk is written.
+// The full uncompressed stream is never staged in memory.
+//
+// Small writes from the serializer are already gathered into large chunks
+// by the context's staging buffer (see 'ctx_flush()'), so each write is 
+// passed straight to the connection.
+//
+// When reading, small reads are served from a fixed-size window which is 
+// refilled from the connection as needed, and large reads are read from 
+// the connection directly into the destination.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#define CON_BUFSIZE (1024 * 1024)
+
+#define HEADER_LEN 4
+
+#define FLAG_VECSXP_REF 0x01
+
+typedef struct {
+  Rconnection con;
+  size_t pos;
+  size_t len;       // Number of valid bytes in 'data'
+  size_t capacity;
+  uint8_t *data;
+} con_buffer_t;
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Callback used by 'write_sexp()'
+// @param user_data a void* to whatever the user passed in as the first
+//        argument of 'create_serialize_ctx()'
+// @param buf the new data output by the serializer
+// @param len the number of bytes in *buf
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void write_con_buffer(void *user_data, void *buf, size_t len) {
+  con_buffer_t *buffer = (con_buffer_t *)user_data;
+
+  size_t nwritten = R_WriteConnection(buffer->con, buf, len);
+  if (nwritten != len) {
+    Rf_error("write_con_buffer(): Write failed. Wrote %li of %li bytes",
+             (long)nwritten, (long)len);
+  }
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Write an object to an R connection
+// - parse any options from the user
+// - write the 4-byte header
+// - serialize the object by calling 'write_sexp()'
+// - flush any remaining staged bytes
+//
+// The connection must already be open for writing in binary mode.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+SEXP write_zap_con_(SEXP obj_, SEXP con_, SEXP opts_) {
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Parse any options from the user
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  opts_t *opts = parse_options(opts_);
+  if (opts->verbosity & ZAP_VERBOSITY_OBJDF) {
+    free(opts);
+    Rf_error("write_zap_con_(): 'verbosity = 64' not supported when writing to a connection");
+  }
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Initialize a 'con_buffer_t *buffer'. 
+  // No local buffering is needed when writing.
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  con_buffer_t *buffer = calloc(1, sizeof(con_buffer_t));
+  if (buffer == NULL) Rf_error("buffer malloc failed");
+  buffer->con = R_GetConnection(con_);
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // - write the header, the object and its index. See 'zap-core.c'
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  ctx_t *ctx = write_zap_sink(obj_, buffer, write_con_buffer, opts);
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // - tidy memory
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  ctx_destroy(ctx);
+  free(buffer);
+  free(opts);
+  return R_NilValue;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Read exactly 'len' bytes from the connection.
+// Connections (particularly compressed ones) may return fewer bytes than
+// requested, so keep reading until satisfied or the stream is exhausted.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static size_t read_con_fully(Rconnection con, uint8_t *dst, size_t len) {
+  size_t total = 0;
+  while (total < len) {
+    size_t nread = R_ReadConnection(con, dst + total, len - total);
+    if (nread == 0) break;
+    total += nread;
+  }
+  return total;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Callback used by 'read_sexp()'
+// @param user_data a void* to whatever the user passed in as the first
+//        argument of 'create_unserialize_ctx()'
+// @param buf destination for the bytes
+// @param len the number of bytes wanted by the unserializer
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void read_con_buffer(void *user_data, void *buf, size_t len) {
+  con_buffer_t *buffer = (con_buffer_t *)user_data;
+  uint8_t *dst = (uint8_t *)buf;
+
+  //---------------------------------------------------------------------------
+  // Serve as much as possible from the current window
+  //---------------------------------------------------------------------------
+  size_t avail = buffer->len - buffer->pos;
+  if (len <= avail) {
+    memcpy(dst, buffer->data + buffer->pos, len);
+    buffer->pos += len;
+    return;
+  }
+
+  memcpy(dst, buffer->data + buffer->pos, avail);
+  dst += avail;
+  len -= avail;
+  buffer->pos = 0;
+  buffer->len = 0;
+
+  //---------------------------------------------------------------------------
+  // Large reads go directly to the destination.
+  // Otherwise refill the window
+  //---------------------------------------------------------------------------
+  if (len >= buffer->capacity) {
+    size_t nread = read_con_fully(buffer->con, dst, len);
+    if (nread != len) {
+      Rf_error("read_con_buffer(): Unexpected end of data. Wanted %li bytes. Got %li", 
+               (long)len, (long)nread);
+    }
+    return;
+  }
+
+  buffer->len = read_con_fully(buffer->con, buffer->data, buffer->capacity);
+  if (buffer->len < len) {
+    Rf_error("read_con_buffer(): Unexpected end of data. Wanted %li bytes. Got %li", 
+             (long)len, (long)buffer->len);
+  }
+  memcpy(dst, buffer->data, len);
+  buffer->pos = len;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Unserialize an object from an R connection
+//
+// - parse any user options
+// - create a con_buffer_t read window around the connection
+// - Check header is valid.
+// - Unserialize data to an R object
+// - Tidy memory and return unserialized object
+//
+// The connection must already be open for reading in binary mode.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+SEXP read_zap_con_(SEXP con_, SEXP opts_) {
+  int nprotect = 0;
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // - parse any user options
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  opts_t *opts = parse_options(opts_);
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Initialize a 'con_buffer_t *buffer'
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  con_buffer_t *buffer = malloc(sizeof(con_buffer_t));
+  if (buffer == NULL) Rf_error("buffer malloc failed");
+  buffer->con = R_GetConnection(con_);
+  buffer->pos = 0;
+  buffer->len = 0;
+  buffer->capacity = CON_BUFSIZE;
+  buffer->data = malloc(buffer->capacity);
+  if (buffer->data == NULL) {
+    free(buffer);
+    Rf_error("buffer->data malloc failed");
+  }
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // - Check header is valid.
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  uint8_t p[HEADER_LEN];
+  read_con_buffer(buffer, p, HEADER_LEN);
+  if (p[0] != ('Z' | 0x80)) {
+    Rf_error("read_zap_con_(): Does not appear to be 'zap', serialized data");
+  }
+  if (p[1] > ZAP_VERSION) {
+    Rf_warning("read_zap_con_(): Version numbers to not match. Expecting %i, Found %i\nAttempting to continue ... ", 
+               ZAP_VERSION, p[1]);
+  }
+  if (p[2] & FLAG_VECSXP_REF) {
+    opts->vec_transform = ZAP_VEC_REF;
+  }
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // - Unserialize data to an R object
+  // If framed, blocks are decompressed one at a time as they are needed
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  frame_reader_t *fr = NULL;
+  ctx_t *ctx = NULL;
+  if (p[3] & FLAG2_FRAMED) {
+    fr  = frame_reader_create(buffer, read_con_buffer, opts);
+    PROTECT(fr->guard_); nprotect++;
+    ctx = create_unserialize_ctx(fr, frame_read, opts);
+  } else {
+    ctx = create_unserialize_ctx(buffer, read_con_buffer, opts);
+  }
+  SEXP res_ = PROTECT(read_sexp(ctx)); nprotect++;
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // - Tidy memory and return unserialized object
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  ctx_destroy(ctx);
+  frame_reader_destroy(fr);
+  free(buffer->data);
+  free(buffer);
+  free(opts);
+  UNPROTECT(nprotect);
+  return res_;
+}
@@ -0,0 +1,115 @@
+#define R_NO_REMAP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include <R.h>
+#include <Rinternals.h>
+#include <Rdefines.h>
+
+#include "io-ctx.h"
+
+// from zap-core.c
+extern SEXP read_zap_mem(uint8_t *src, size_t len, SEXP opts_, SEXP map_);
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Memory-mapped files
+//
+// An uncompressed file is mapped read-only and decoded straight from the
+// mapping.  Vectors whose payload was aligned when written (option 'align',
+// see 'io-align.h') are not copied at all: they are returned as ALTREP
+// vectors which point into the mapping.  See 'utils-altrep-mmap.c'
+//
+// The mapping is owned by an external pointer (addr = start of mapping,
+// tag = its size) whose finalizer unmaps the file.  Each mapped vector 
+// keeps this alive, so the file is unmapped once the last of them is 
+// garbage collected.
+//
+// The file must not be changed or truncated while it is mapped.
+//
+// Without 'borrow', the mapping is only the read window (e.g. for 
+// decoding in parallel) and is unmapped before returning. Nothing in the 
+// result points into it.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#ifndef _WIN32
+
+static void map_finalizer(SEXP map_) {
+  void *p = R_ExternalPtrAddr(map_);
+  if (p == NULL) return;
+  munmap(p, (size_t)Rf_asReal(R_ExternalPtrTag(map_)));
+  R_ClearExternalPtr(map_);
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Unserialize an object from a memory-mapped file
+//
+// @param filename_ path to an uncompressed zap file
+// @param opts_ user options
+// @param borrow_ may aligned vectors point into the mapping? 
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+SEXP read_zap_mmap_(SEXP filename_, SEXP opts_, SEXP borrow_) {
+  
+  if (!Rf_isString(filename_) || Rf_length(filename_) != 1) {
+    Rf_error("read_zap_mmap_(): 'filename' must be a single string");
+  }
+  const char *filename = R_ExpandFileName(CHAR(STRING_ELT(filename_, 0)));
+  
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    Rf_error("read_zap_mmap_(): Couldn't open '%s': %s", filename, strerror(errno));
+  }
+  
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    int err = errno;
+    close(fd);
+    Rf_error("read_zap_mmap_(): Couldn't get the size of '%s': %s", filename, strerror(err));
+  }
+  if (st.st_size == 0) {
+    close(fd);
+    Rf_error("read_zap_mmap_(): '%s' is empty", filename);
+  }
+  
+  // The mapping remains valid after the file is closed
+  void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  int err = errno;
+  close(fd);
+  if (p == MAP_FAILED) {
+    Rf_error("read_zap_mmap_(): Couldn't map '%s': %s", filename, strerror(err));
+  }
+  
+  SEXP size_ = PROTECT(Rf_ScalarReal((double)st.st_size));
+  SEXP map_  = PROTECT(R_MakeExternalPtr(p, size_, R_NilValue));
+  R_RegisterCFinalizerEx(map_, map_finalizer, TRUE);
+  
+  bool borrow = Rf_asLogical(borrow_) == TRUE;
+  SEXP res_ = PROTECT(read_zap_mem(p, (size_t)st.st_size, opts_, borrow ? map_ : R_NilValue));
+  if (!borrow) {
+    map_finalizer(map_);
+  }
+  
+  UNPROTECT(3);
+  return res_;
+}
+
+#else
+
+SEXP read_zap_mmap_(SEXP filename_, SEXP opts_, SEXP borrow_) {
+  Rf_error("read_zap_mmap_(): Memory-mapped files are not supported on Windows");
+  return R_NilValue;
+}
+
+#endif
@@ -0,0 +1,536 @@
+
+#define R_NO_REMAP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <R.h>
+#include <Rinternals.h>
+#include <Rdefines.h>
+
+#include "io-ctx.h"
+#include "io-core.h"
+#include "io-frame.h"
+#include "io-index.h"
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Push decoder
+//
+// Bytes are fed in as they arrive (e.g. from a socket) in pieces of any
+// size, and each object is returned as soon as all its bytes have been
+// fed.  Several objects may follow each other in the input.
+//
+// Decoding resumes where it stopped.  Lists are created as soon as their
+// header arrives and filled in one element at a time, so the decoder only
+// keeps the bytes of the element it is part way through:
+//   - framed streams: each block is decompressed as soon as it has arrived
+//     and decoded as far as it goes.  Decompressed bytes are dropped once 
+//     the elements they hold are done.
+//   - unframed streams: decoding is tried on the bytes received so far.  
+//     If it runs out part way through an element, that element is tried 
+//     again from its start once at least as many bytes as it wanted have 
+//     arrived.
+// Only the element which ran out is decoded again, so the total work is
+// linear in the size of the stream unless a single element (e.g. a long
+// vector) arrives in many small pieces.
+//
+// An index after a stream (see 'io-index.h') is skipped.
+//
+// An error leaves the decoder part way through a call, so the next call
+// starts afresh and anything not yet returned is dropped.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#define HEADER_LEN 4
+
+#define FLAG_VECSXP_REF 0x01
+
+#define PUSH_HEADER 0
+#define PUSH_FRAMED 1
+#define PUSH_PLAIN  2
+
+// R objects kept by the decoder, in the 'tag' of its external pointer
+#define PUSH_KEEP_OPEN 0  // Lists being filled in, outermost first
+#define PUSH_KEEP_DONE 1  // PUSH_FRAMED: the object, waiting for the end of the stream
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Bytes of the current stream available to the context
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+typedef struct {
+  uint8_t *data;
+  size_t len;
+  size_t pos;
+  bool starved;   // A read wanted more than 'len'
+  size_t need;    // If starved, the number of bytes it wanted
+} source_t;
+
+typedef struct {
+  int state;
+  uint8_t header[HEADER_LEN];
+  bool index;    // The current stream is the index of the previous one
+  size_t skip;   // Bytes still to be dropped before the next header
+  size_t need;   // Bytes of the stream needed before trying again
+  bool busy;     // Set during 'zap_push_feed_()'. Still set if it errored
+
+  // Decoding of the current stream. NULL until it starts
+  opts_t *opts;
+  ctx_t *ctx;
+  source_t src;
+
+  // For each list being filled in, the next element to read
+  R_xlen_t *next;
+  int depth;
+  int depth_capacity;
+  bool done;     // PUSH_FRAMED: the object is complete
+
+  // Received bytes not used yet
+  uint8_t *in;
+  size_t in_len;
+  size_t in_capacity;
+
+  // PUSH_FRAMED: decompressed bytes of the current stream not used yet
+  uint8_t *out;
+  size_t out_len;
+  size_t out_capacity;
+} push_t;
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Forget the object being decoded
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void push_clear(push_t *push) {
+  ctx_destroy(push->ctx);
+  free(push->opts);
+  push->ctx     = NULL;
+  push->opts    = NULL;
+  push->depth   = 0;
+  push->done    = false;
+  push->need    = 0;
+  push->out_len = 0;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Forget everything about the current stream
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void push_reset(push_t *push) {
+  push_clear(push);
+  push->state   = PUSH_HEADER;
+  push->index   = false;
+  push->skip    = 0;
+  push->busy    = false;
+  push->in_len  = 0;
+}
+
+
+static SEXP push_keep(void) {
+  SEXP keep_ = PROTECT(Rf_allocVector(VECSXP, 2));
+  SET_VECTOR_ELT(keep_, PUSH_KEEP_OPEN, Rf_allocVector(VECSXP, 8));
+  UNPROTECT(1);
+  return keep_;
+}
+
+
+static void push_finalizer(SEXP ptr_) {
+  push_t *push = (push_t *)R_ExternalPtrAddr(ptr_);
+  if (push == NULL) return;
+  push_clear(push);
+  free(push->next);
+  free(push->in);
+  free(push->out);
+  free(push);
+  R_ClearExternalPtr(ptr_);
+}
+
+
+static push_t *get_push(SEXP ptr_) {
+  if (TYPEOF(ptr_) != EXTPTRSXP) {
+    Rf_error("zap_decoder: Not a decoder");
+  }
+  push_t *push = (push_t *)R_ExternalPtrAddr(ptr_);
+  if (push == NULL) {
+    Rf_error("zap_decoder: Decoder is no longer valid");
+  }
+  return push;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Create a decoder. The options are kept for decoding every object
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+SEXP zap_push_create_(SEXP opts_) {
+  // Check the options now rather than on the first object
+  free(parse_options(opts_));
+
+  push_t *push = calloc(1, sizeof(push_t));
+  if (push == NULL) Rf_error("zap_push_create_(): calloc failed");
+  push_reset(push);
+
+  SEXP ptr_ = PROTECT(R_MakeExternalPtr(push, push_keep(), opts_));
+  R_RegisterCFinalizerEx(ptr_, push_finalizer, TRUE);
+  UNPROTECT(1);
+  return ptr_;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Callback used by 'read_sexp()'.  Running out of bytes abandons the 
+// element being decoded
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void read_source(void *user_data, void *buf, size_t len) {
+  source_t *src = (source_t *)user_data;
+  if (len > src->len - src->pos) {
+    src->starved = true;
+    src->need    = src->pos + len;
+    Rf_error("zap_decoder: Waiting for more data");
+  }
+  memcpy(buf, src->data + src->pos, len);
+  src->pos += len;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// A single attempt at continuing the stream from the bytes received so far
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+typedef struct {
+  push_t *push;
+  SEXP keep_;
+  size_t mark;       // Start of the step being decoded
+  R_xlen_t Nenv;     // Cached objects at 'mark'
+  R_xlen_t Nvecsxp;
+  bool failed;
+  char msg[512];
+} attempt_t;
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Open a list which is to be filled in
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void open_list(attempt_t *at, SEXP obj_) {
+  push_t *push = at->push;
+
+  if (push->depth == push->depth_capacity) {
+    int capacity = push->depth_capacity == 0 ? 8 : 2 * push->depth_capacity;
+    R_xlen_t *tmp = realloc(push->next, (size_t)capacity * sizeof(R_xlen_t));
+    if (tmp == NULL) Rf_error("zap_decoder: realloc failed");
+    push->next = tmp;
+    push->depth_capacity = capacity;
+  }
+
+  SEXP open_ = VECTOR_ELT(at->keep_, PUSH_KEEP_OPEN);
+  if (push->depth == Rf_xlength(open_)) {
+    open_ = Rf_xlengthgets(open_, 2 * Rf_xlength(open_));
+    SET_VECTOR_ELT(at->keep_, PUSH_KEEP_OPEN, open_);
+  }
+
+  SET_VECTOR_ELT(open_, push->depth, obj_);
+  push->next[push->depth] = 0;
+  push->depth++;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Decode the stream one step at a time.  A step is the header of a list,
+// the attributes of a list, or any other object in full (see 
+// 'read_VECSXP_raw()' and 'read_sexp()').  Each step is added to the lists
+// being filled in as soon as it is complete, so running out of bytes only
+// loses the step in progress.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static SEXP attempt_body(void *data) {
+  attempt_t *at = (attempt_t *)data;
+  push_t *push  = at->push;
+  ctx_t *ctx    = push->ctx;
+  source_t *src = &push->src;
+
+  while (true) {
+    at->mark    = src->pos;
+    at->Nenv    = ctx->Nenv;
+    at->Nvecsxp = ctx->Nvecsxp;
+
+    SEXP open_ = VECTOR_ELT(at->keep_, PUSH_KEEP_OPEN);
+    SEXP obj_  = R_NilValue;
+
+    if (push->depth > 0 && 
+        push->next[push->depth - 1] == Rf_xlength(VECTOR_ELT(open_, push->depth - 1))) {
+      //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+      // All the elements are done. The attributes follow
+      //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+      obj_ = VECTOR_ELT(open_, push->depth - 1);
+      read_attrs(ctx, obj_);
+      push->depth--;
+      obj_ = PROTECT(obj_);
+      SET_VECTOR_ELT(open_, push->depth, R_NilValue);
+    } else if (src->pos < src->len && src->data[src->pos] == VECSXP) {
+      //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+      // A list (not a reference to one). Fill in its elements as they come
+      //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+      read_uint8(ctx);
+      R_xlen_t len = (R_xlen_t)read_len(ctx);
+      obj_ = PROTECT(Rf_allocVector(VECSXP, len));
+
+      if (ctx->opts->vec_transform == ZAP_VEC_REF) {
+        SEXP vecsxp_list_ = VECTOR_ELT(ctx->cache, ZAP_CACHE_VECSXP);
+        SET_VECTOR_ELT(vecsxp_list_, ctx->Nvecsxp, obj_);
+        ctx->Nvecsxp++;
+        if (ctx->Nvecsxp >= Rf_xlength(vecsxp_list_)) {
+          SEXP expanded_vecsxp_list_ = PROTECT(Rf_lengthgets(vecsxp_list_, 2 * Rf_length(vecsxp_list_)));
+          SET_VECTOR_ELT(ctx->cache, ZAP_CACHE_VECSXP, expanded_vecsxp_list_);
+          UNPROTECT(1);
+        }
+      }
+
+      open_list(at, obj_);
+      UNPROTECT(1);
+      continue;
+    } else {
+      obj_ = PROTECT(read_sexp(ctx));
+    }
+
+    //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+    // A complete object. Either the next element of the innermost list, 
+    // or the whole stream
+    //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+    if (push->depth == 0) {
+      UNPROTECT(1);
+      return obj_;
+    }
+    open_ = VECTOR_ELT(at->keep_, PUSH_KEEP_OPEN);
+    SET_VECTOR_ELT(VECTOR_ELT(open_, push->depth - 1), push->next[push->depth - 1], obj_);
+    push->next[push->depth - 1]++;
+    UNPROTECT(1);
+  }
+}
+
+static SEXP attempt_handler(SEXP cond_, void *data) {
+  attempt_t *at = (attempt_t *)data;
+  at->failed = true;
+  SEXP msg_ = TYPEOF(cond_) == VECSXP && Rf_length(cond_) > 0 ? VECTOR_ELT(cond_, 0) : R_NilValue;
+  if (TYPEOF(msg_) == STRSXP && Rf_length(msg_) > 0) {
+    snprintf(at->msg, sizeof(at->msg), "%s", CHAR(STRING_ELT(msg_, 0)));
+  } else {
+    snprintf(at->msg, sizeof(at->msg), "unknown error");
+  }
+  return R_NilValue;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Continue decoding the stream (following its header)
+//
+// @param data,len bytes of the stream received so far, starting where the
+//        last attempt left off
+// @param used [out] the number of bytes at 'data' which are done with
+// @return true if the object is complete. It is in PUSH_KEEP_DONE
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static bool attempt_decode(push_t *push, SEXP ptr_, uint8_t *data, size_t len, size_t *used) {
+  SEXP keep_ = R_ExternalPtrTag(ptr_);
+
+  if (push->ctx == NULL) {
+    push->opts = parse_options(R_ExternalPtrProtected(ptr_));
+    if (push->header[2] & FLAG_VECSXP_REF) {
+      push->opts->vec_transform = ZAP_VEC_REF;
+    }
+    push->ctx = create_unserialize_ctx(&push->src, read_source, push->opts);
+  }
+
+  memset(&push->src, 0, sizeof(source_t));
+  push->src.data = data;
+  push->src.len  = len;
+
+  attempt_t at;
+  memset(&at, 0, sizeof(attempt_t));
+  at.push  = push;
+  at.keep_ = keep_;
+
+  SEXP res_ = PROTECT(R_tryCatchError(attempt_body, &at, attempt_handler, &at));
+
+  if (at.failed && !push->src.starved) {
+    Rf_error("zap_decoder_feed(): %s", at.msg);
+  }
+
+  if (at.failed) {
+    // Undo the step in progress. It is started again next time
+    push->ctx->Nenv    = at.Nenv;
+    push->ctx->Nvecsxp = at.Nvecsxp;
+    push->need         = push->src.need - at.mark;
+    *used = at.mark;
+    UNPROTECT(1);
+    return false;
+  }
+
+  SET_VECTOR_ELT(keep_, PUSH_KEEP_DONE, res_);
+  ctx_destroy(push->ctx);
+  free(push->opts);
+  push->ctx  = NULL;
+  push->opts = NULL;
+  push->need = 0;
+  *used = push->src.pos;
+  UNPROTECT(1);
+  return true;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Append an object to the results, growing the list as needed
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void append_result(SEXP *res_, PROTECT_INDEX ipx, R_xlen_t *n, SEXP obj_) {
+  if (*n == Rf_xlength(*res_)) {
+    *res_ = Rf_xlengthgets(*res_, 2 * *n);
+    REPROTECT(*res_, ipx);
+  }
+  SET_VECTOR_ELT(*res_, *n, obj_);
+  (*n)++;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// A stream has been decoded.  If it had an index, the index comes next
+//
+// @return true if the object should be returned to the caller
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static bool stream_done(push_t *push) {
+  bool keep = !push->index;
+  if (push->index) {
+    push->index = false;
+    push->skip  = INDEX_TRAILER_LEN;
+  } else if (push->header[3] & FLAG2_INDEX) {
+    push->index = true;
+  }
+  push->state = PUSH_HEADER;
+  push_clear(push);
+  return keep;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Feed bytes to the decoder
+//
+// @param ptr_ decoder from 'zap_push_create_()'
+// @param raw_ raw vector of the next bytes of input
+// @return list of the objects completed by these bytes (possibly empty)
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+SEXP zap_push_feed_(SEXP ptr_, SEXP raw_) {
+  push_t *push = get_push(ptr_);
+
+  if (TYPEOF(raw_) != RAWSXP) {
+    Rf_error("zap_decoder_feed(): 'raw' must be a raw vector");
+  }
+  if (push->busy) {
+    push_reset(push);
+    R_SetExternalPtrTag(ptr_, push_keep());
+  }
+  push->busy = true;
+  SEXP keep_ = R_ExternalPtrTag(ptr_);
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Add the new bytes to any left over from before
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  size_t len = (size_t)Rf_xlength(raw_);
+  if (push->in_len + len > push->in_capacity) {
+    size_t capacity = push->in_len + len;
+    if (capacity < 2 * push->in_capacity) capacity = 2 * push->in_capacity;
+    uint8_t *tmp = realloc(push->in, capacity);
+    if (tmp == NULL) Rf_error("zap_push_feed_(): realloc failed");
+    push->in = tmp;
+    push->in_capacity = capacity;
+  }
+  if (len > 0) {
+    memcpy(push->in + push->in_len, RAW(raw_), len);
+    push->in_len += len;
+  }
+
+  PROTECT_INDEX ipx;
+  SEXP res_ = Rf_allocVector(VECSXP, 4);
+  PROTECT_WITH_INDEX(res_, &ipx);
+  R_xlen_t nres = 0;
+
+  size_t pos = 0;
+  while (true) {
+    uint8_t *p   = push->in + pos;
+    size_t avail = push->in_len - pos;
+    size_t used  = 0;
+
+    if (push->skip > 0) {
+      size_t n = push->skip < avail ? push->skip : avail;
+      pos        += n;
+      push->skip -= n;
+      if (push->skip > 0) break;
+      continue;
+    }
+
+    if (push->state == PUSH_HEADER) {
+      //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+      // Header of the next stream
+      //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+      if (avail < HEADER_LEN) break;
+      memcpy(push->header, p, HEADER_LEN);
+      pos += HEADER_LEN;
+      if (push->header[0] != ('Z' | 0x80)) {
+        Rf_error("zap_decoder_feed(): Does not appear to be 'zap', serialized data. "
+                 "Only compress = 'none', 'deflate' or 'lz4' can be decoded as it arrives");
+      }
+      if (push->header[1] > ZAP_VERSION) {
+        Rf_warning("zap_decoder_feed(): Version numbers to not match. Expecting %i, Found %i\nAttempting to continue ... ",
+                   ZAP_VERSION, push->header[1]);
+      }
+      push->state = (push->header[3] & FLAG2_FRAMED) ? PUSH_FRAMED : PUSH_PLAIN;
+      continue;
+    } 
+    
+    bool complete = false;
+    if (push->state == PUSH_FRAMED) {
+      //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+      // Decompress each block as it arrives, and decode as far as it goes.
+      // The object is returned after the end-of-stream block
+      //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+      bool end;
+      size_t nbytes = frame_unpack_next(p, avail, &push->out, &push->out_len,
+                                        &push->out_capacity, &end);
+      if (nbytes == 0) break;
+      pos += nbytes;
+
+      if (!push->done && (end || push->out_len >= push->need)) {
+        push->done = attempt_decode(push, ptr_, push->out, push->out_len, &used);
+        memmove(push->out, push->out + used, push->out_len - used);
+        push->out_len -= used;
+      }
+      if (!end) continue;
+      if (!push->done) {
+        Rf_error("zap_decoder_feed(): Unexpected end of data");
+      }
+      complete = true;
+    } else {
+      //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+      // Unframed. Try again only once there are at least as many bytes as 
+      // last time wanted
+      //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+      if (avail == 0 || avail < push->need) break;
+
+      complete = attempt_decode(push, ptr_, p, avail, &used);
+      pos += used;
+      if (!complete) break;
+    }
+
+    SEXP obj_ = PROTECT(VECTOR_ELT(keep_, PUSH_KEEP_DONE));
+    SET_VECTOR_ELT(keep_, PUSH_KEEP_DONE, R_NilValue);
+    if (stream_done(push)) append_result(&res_, ipx, &nres, obj_);
+    UNPROTECT(1);
+  }
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Keep the bytes which haven't been used
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  if (pos > 0) {
+    memmove(push->in, push->in + pos, push->in_len - pos);
+    push->in_len -= pos;
+  }
+  push->busy = false;
+
+  res_ = Rf_xlengthgets(res_, nres);
+  UNPROTECT(1);
+  return res_;
+}
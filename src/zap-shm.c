@@ -0,0 +1,309 @@
+#define R_NO_REMAP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include <R.h>
+#include <Rinternals.h>
+#include <Rdefines.h>
+
+#include "io-ctx.h"
+#include "io-core.h"
+
+// from zap-core.c
+extern SEXP read_zap_mem(uint8_t *src, size_t len, SEXP opts_, SEXP map_);
+extern ctx_t *write_zap_sink(SEXP obj_, void *sink,
+                             void (*sink_write)(void *user_data, void *buf, size_t len),
+                             opts_t *opts);
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// POSIX shared memory
+//
+// The object is encoded straight into a shared memory segment which is
+// grown as needed, and decoded straight from a read-only mapping of it,
+// so handing an object to another process on the same host makes no copy
+// other than the encoding and decoding themselves.
+//
+// Layout of the segment:
+//   [0-3]   SHM_MAGIC
+//   [4-11]  length of the stream (uint64_t, little endian). Written last,
+//           so zero if the write did not finish
+//   [12-]   the stream, exactly as returned by 'write_zap_()'
+//
+// The stream's 4-byte header puts the data which follows it on a 16-byte
+// boundary (mappings start on a page boundary).
+//
+// The segment persists until removed with 'zap_shm_remove_()'.
+//
+// Writing to a name which is already in use removes the old segment and
+// creates a new one, rather than truncating the old one in place: a
+// process which still has the old segment mapped would get SIGBUS when
+// touching pages past the new end.  That process keeps the old data.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#define HEADER_LEN 4
+
+#define SHM_MAGIC        "ZSHM"
+#define SHM_HEADER_LEN   12
+#define SHM_INIT_SIZE    (1024 * 1024)
+
+#ifndef _WIN32
+
+typedef struct {
+  int fd;
+  uint8_t *data;     // Mapping of the whole segment
+  size_t pos;
+  size_t capacity;   // Size of the segment
+} shm_buffer_t;
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Unmap and close.  Also the finalizer of the guard, so that the mapping
+// is released if an R error is raised part way through
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void shm_buffer_destroy(shm_buffer_t *shm) {
+  if (shm == NULL) return;
+  if (shm->data != NULL) munmap(shm->data, shm->capacity);
+  if (shm->fd >= 0) close(shm->fd);
+  free(shm);
+}
+
+static void shm_buffer_finalizer(SEXP guard_) {
+  shm_buffer_destroy((shm_buffer_t *)R_ExternalPtrAddr(guard_));
+  R_ClearExternalPtr(guard_);
+}
+
+static SEXP shm_buffer_guard(shm_buffer_t *shm) {
+  SEXP guard_ = PROTECT(R_MakeExternalPtr(shm, R_NilValue, R_NilValue));
+  R_RegisterCFinalizerEx(guard_, shm_buffer_finalizer, TRUE);
+  UNPROTECT(1);
+  return guard_;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Grow the segment to hold at least 'len' bytes. Capacity is doubled so
+// the number of remaps is logarithmic in the final size.  Pages already
+// written belong to the segment, so remapping copies nothing.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void shm_reserve(shm_buffer_t *shm, size_t len) {
+  if (len <= shm->capacity) return;
+
+  size_t capacity = 2 * shm->capacity;
+  if (capacity < len) capacity = len;
+  if (ftruncate(shm->fd, (off_t)capacity) != 0) {
+    Rf_error("zap_shm: Couldn't grow shared memory to %.0f bytes: %s",
+             (double)capacity, strerror(errno));
+  }
+
+  void *p = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, shm->fd, 0);
+  if (p == MAP_FAILED) {
+    Rf_error("zap_shm: Couldn't map %.0f bytes of shared memory: %s",
+             (double)capacity, strerror(errno));
+  }
+  if (shm->data != NULL) munmap(shm->data, shm->capacity);
+  shm->data     = p;
+  shm->capacity = capacity;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Callback used by 'write_sexp()'
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void write_shm_buffer(void *user_data, void *buf, size_t len) {
+  shm_buffer_t *shm = (shm_buffer_t *)user_data;
+  shm_reserve(shm, shm->pos + len);
+  memcpy(shm->data + shm->pos, buf, len);
+  shm->pos += len;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Write an object to a shared memory segment
+// - parse any options from the user
+// - remove any old segment of the same name and create a new one
+// - write the 4-byte header
+// - serialize the object by calling 'write_sexp()'
+// - record the length of the stream
+//
+// @param name_ name of the segment e.g. "/zap_results"
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+SEXP write_zap_shm_(SEXP obj_, SEXP name_, SEXP opts_) {
+  int nprotect = 0;
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Parse any options from the user
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  if (!Rf_isString(name_) || Rf_length(name_) != 1) {
+    Rf_error("write_zap_shm_(): 'name' must be a single string");
+  }
+  const char *name = CHAR(STRING_ELT(name_, 0));
+
+  opts_t *opts = parse_options(opts_);
+  if (opts->verbosity & ZAP_VERBOSITY_OBJDF) {
+    free(opts);
+    Rf_error("write_zap_shm_(): 'verbosity = 64' not supported when writing to shared memory");
+  }
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Create the segment
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  shm_buffer_t *shm = calloc(1, sizeof(shm_buffer_t));
+  if (shm == NULL) Rf_error("write_zap_shm_(): calloc failed");
+  if (shm_unlink(name) != 0 && errno != ENOENT) {
+    int err = errno;
+    free(shm);
+    free(opts);
+    Rf_error("write_zap_shm_(): Couldn't replace shared memory '%s': %s", name, strerror(err));
+  }
+  shm->fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (shm->fd < 0) {
+    int err = errno;
+    free(shm);
+    free(opts);
+    Rf_error("write_zap_shm_(): Couldn't create shared memory '%s': %s", name, strerror(err));
+  }
+  SEXP guard_ = PROTECT(shm_buffer_guard(shm)); nprotect++;
+  shm_reserve(shm, SHM_INIT_SIZE);
+
+  memcpy(shm->data, SHM_MAGIC, 4);
+  memset(shm->data + 4, 0, 8);
+  shm->pos = SHM_HEADER_LEN;
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // - write the header, the object and its index. See 'zap-core.c'
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  ctx_t *ctx = write_zap_sink(obj_, shm, write_shm_buffer, opts);
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // - record the length, which marks the segment as complete
+  // - release the slack from doubling.  Not all systems allow a segment
+  //   to be resized again, and the recorded length is what counts, so a
+  //   failure here is ignored
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  uint64_t len = (uint64_t)(shm->pos - SHM_HEADER_LEN);
+  for (int i = 0; i < 8; i++) {
+    shm->data[4 + i] = (uint8_t)(len >> (8 * i));
+  }
+  munmap(shm->data, shm->capacity);
+  shm->data = NULL;
+  if (ftruncate(shm->fd, (off_t)shm->pos) != 0) {
+    // Keep the larger segment
+  }
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // - tidy memory
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  ctx_destroy(ctx);
+  shm_buffer_destroy(shm);
+  R_ClearExternalPtr(guard_);
+  free(opts);
+  UNPROTECT(nprotect);
+  return R_NilValue;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Unserialize an object from a shared memory segment
+//
+// The segment is mapped read-only and decoded in place as for a raw
+// vector (see 'read_zap_()'), so vector data is borrowed directly from the
+// mapping rather than copied out first.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+SEXP read_zap_shm_(SEXP name_, SEXP opts_) {
+  if (!Rf_isString(name_) || Rf_length(name_) != 1) {
+    Rf_error("read_zap_shm_(): 'name' must be a single string");
+  }
+  const char *name = CHAR(STRING_ELT(name_, 0));
+
+  shm_buffer_t *shm = calloc(1, sizeof(shm_buffer_t));
+  if (shm == NULL) Rf_error("read_zap_shm_(): calloc failed");
+  shm->fd = shm_open(name, O_RDONLY, 0);
+  if (shm->fd < 0) {
+    int err = errno;
+    free(shm);
+    Rf_error("read_zap_shm_(): Couldn't open shared memory '%s': %s", name, strerror(err));
+  }
+  SEXP guard_ = PROTECT(shm_buffer_guard(shm));
+
+  struct stat st;
+  if (fstat(shm->fd, &st) != 0) {
+    Rf_error("read_zap_shm_(): Couldn't get the size of '%s': %s", name, strerror(errno));
+  }
+  if ((size_t)st.st_size < SHM_HEADER_LEN + HEADER_LEN) {
+    Rf_error("read_zap_shm_(): '%s' does not hold zap data", name);
+  }
+
+  void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, shm->fd, 0);
+  if (p == MAP_FAILED) {
+    Rf_error("read_zap_shm_(): Couldn't map '%s': %s", name, strerror(errno));
+  }
+  shm->data     = p;
+  shm->capacity = (size_t)st.st_size;
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Check the segment is complete
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  if (memcmp(shm->data, SHM_MAGIC, 4) != 0) {
+    Rf_error("read_zap_shm_(): '%s' does not hold zap data", name);
+  }
+  uint64_t len = 0;
+  for (int i = 0; i < 8; i++) {
+    len |= (uint64_t)shm->data[4 + i] << (8 * i);
+  }
+  if (len == 0 || len > shm->capacity - SHM_HEADER_LEN) {
+    Rf_error("read_zap_shm_(): '%s' is incomplete. Was the write interrupted?", name);
+  }
+
+  SEXP res_ = PROTECT(read_zap_mem(shm->data + SHM_HEADER_LEN, (size_t)len, opts_, R_NilValue));
+
+  shm_buffer_destroy(shm);
+  R_ClearExternalPtr(guard_);
+  UNPROTECT(2);
+  return res_;
+}
+
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Remove a shared memory segment.  Processes which have it mapped keep
+// their mapping.
+//
+// @return TRUE if it was removed. FALSE if it did not exist
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+SEXP zap_shm_remove_(SEXP name_) {
+  if (!Rf_isString(name_) || Rf_length(name_) != 1) {
+    Rf_error("zap_shm_remove_(): 'name' must be a single string");
+  }
+  const char *name = CHAR(STRING_ELT(name_, 0));
+
+  if (shm_unlink(name) == 0) return Rf_ScalarLogical(TRUE);
+  if (errno == ENOENT) return Rf_ScalarLogical(FALSE);
+  Rf_error("zap_shm_remove_(): Couldn't remove '%s': %s", name, strerror(errno));
+}
+
+#else
+
+SEXP write_zap_shm_(SEXP obj_, SEXP name_, SEXP opts_) {
+  Rf_error("zap_shm(): Shared memory is not supported on Windows");
+}
+
+SEXP read_zap_shm_(SEXP name_, SEXP opts_) {
+  Rf_error("zap_shm(): Shared memory is not supported on Windows");
+}
+
+SEXP zap_shm_remove_(SEXP name_) {
+  Rf_error("zap_shm(): Shared memory is not supported on Windows");
+}
+
+#endif